@@ -0,0 +1,194 @@
+// Compares two result files of linaro_bench_runner, a baseline and a
+// candidate. For every benchmark in both it prints the speedup of the
+// candidate (baseline median over candidate median), a bootstrap confidence
+// interval of it, and the p-value of a Mann-Whitney U test of the two sets
+// of runs. A benchmark regressed if it's slower by more than the threshold
+// and the difference is significant: the test rejects at 'alpha' and the
+// interval doesn't contain 1. A benchmark the candidate failed regressed
+// too, and benchmarks in only one of the files are reported.
+//
+// usage: linaro_bench_compare baseline.json candidate.json [--threshold pct]
+//                             [--alpha p] [--resamples n]
+//
+// Exits with 1 if a benchmark regressed, so it can gate merges.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct Benchmark {
+  std::vector<double> runs;
+  bool failed = false;
+};
+
+using Results = std::map<std::string, Benchmark>;
+
+// Reads the benchmarks of a result file. Only understands the layout the
+// runner writes, one benchmark per line.
+static bool readResults(const char* file, Results& results) {
+  std::ifstream in(file);
+  if (!in) return false;
+  std::string line;
+  const std::string name_key = "{\"name\": \"";
+  const std::string runs_key = "\"runs\": [";
+  while (std::getline(in, line)) {
+    size_t name = line.find(name_key);
+    size_t runs = line.find(runs_key);
+    if (name == std::string::npos || runs == std::string::npos) continue;
+    name += name_key.size();
+    Benchmark& benchmark =
+        results[line.substr(name, line.find('"', name) - name)];
+    benchmark.failed = line.find("\"failed\": true") != std::string::npos;
+    std::istringstream values(
+        line.substr(runs + runs_key.size(),
+                    line.find(']', runs) - runs - runs_key.size()));
+    std::string value;
+    while (std::getline(values, value, ','))
+      benchmark.runs.push_back(std::atof(value.c_str()));
+  }
+  return true;
+}
+
+static double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  size_t n = values.size();
+  return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+// Two-sided p-value of the Mann-Whitney U test, from the normal
+// approximation with a correction for ties.
+static double mannWhitney(const std::vector<double>& a,
+                          const std::vector<double>& b) {
+  std::vector<std::pair<double, int>> all;
+  for (double value : a) all.push_back({value, 0});
+  for (double value : b) all.push_back({value, 1});
+  std::sort(all.begin(), all.end());
+  double n1 = a.size(), n2 = b.size(), n = n1 + n2;
+  double rank_sum = 0, ties = 0;
+  for (size_t i = 0; i < all.size();) {
+    size_t j = i;
+    while (j < all.size() && all[j].first == all[i].first) j++;
+    double rank = (i + 1 + j) / 2.0;
+    double t = j - i;
+    ties += t * t * t - t;
+    for (size_t k = i; k < j; k++) {
+      if (all[k].second == 0) rank_sum += rank;
+    }
+    i = j;
+  }
+  double u = rank_sum - n1 * (n1 + 1) / 2;
+  double mean = n1 * n2 / 2;
+  double variance = n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)));
+  if (variance <= 0) return 1;
+  double z = (std::abs(u - mean) - 0.5) / std::sqrt(variance);
+  return std::min(1.0, std::erfc(std::max(z, 0.0) / std::sqrt(2.0)));
+}
+
+// 95% confidence interval of median(base) / median(candidate), from
+// resampling both sets of runs.
+static std::pair<double, double> bootstrap(const std::vector<double>& base,
+                                           const std::vector<double>& cand,
+                                           int resamples) {
+  std::mt19937 random(42);
+  std::vector<double> ratios;
+  std::vector<double> a(base.size()), b(cand.size());
+  for (int r = 0; r < resamples; r++) {
+    for (double& value : a) value = base[random() % base.size()];
+    for (double& value : b) value = cand[random() % cand.size()];
+    ratios.push_back(median(a) / median(b));
+  }
+  std::sort(ratios.begin(), ratios.end());
+  return {ratios[(size_t)(0.025 * (resamples - 1))],
+          ratios[(size_t)(0.975 * (resamples - 1))]};
+}
+
+static void usage() {
+  std::cerr << "usage: linaro_bench_compare baseline.json candidate.json "
+               "[--threshold pct]\n"
+            << "                            [--alpha p] [--resamples n]\n";
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    usage();
+    return 2;
+  }
+  double threshold = 5;
+  double alpha = 0.05;
+  int resamples = 10000;
+  for (int i = 3; i < argc; i++) {
+    if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+      threshold = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--alpha") == 0 && i + 1 < argc) {
+      alpha = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--resamples") == 0 && i + 1 < argc) {
+      resamples = std::max(1, atoi(argv[++i]));
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  Results base, cand;
+  for (int i = 1; i <= 2; i++) {
+    if (!readResults(argv[i], i == 1 ? base : cand)) {
+      std::cerr << "Failed to read " << argv[i] << '\n';
+      return 2;
+    }
+  }
+
+  int regressions = 0;
+  printf("%-12s %10s %10s %8s %17s %8s  %s\n", "benchmark", "base s", "cand s",
+         "speedup", "95% interval", "p", "verdict");
+  for (const auto& [name, candidate] : cand) {
+    if (candidate.failed) {
+      printf("%-12s %s\n", name.c_str(), "REGRESSION (candidate failed)");
+      regressions++;
+      continue;
+    }
+    auto it = base.find(name);
+    if (it == base.end()) {
+      printf("%-12s %s\n", name.c_str(), "skipped (not in baseline)");
+      continue;
+    }
+    const Benchmark& baseline = it->second;
+    if (baseline.failed || baseline.runs.empty() || candidate.runs.empty()) {
+      printf("%-12s %s\n", name.c_str(),
+             baseline.failed ? "skipped (baseline failed)"
+                             : "skipped (no runs)");
+      continue;
+    }
+    double base_median = median(baseline.runs);
+    double cand_median = median(candidate.runs);
+    double speedup = base_median / cand_median;
+    auto [lo, hi] = bootstrap(baseline.runs, candidate.runs, resamples);
+    double p = mannWhitney(baseline.runs, candidate.runs);
+    bool significant = p < alpha && (hi < 1 || lo > 1);
+    const char* verdict = "same";
+    if (significant && speedup < 1 / (1 + threshold / 100)) {
+      verdict = "REGRESSION";
+      regressions++;
+    } else if (significant) {
+      verdict = speedup > 1 ? "faster" : "slower";
+    }
+    printf("%-12s %10.4f %10.4f %7.3fx  [%6.3f, %6.3f] %8.4f  %s\n",
+           name.c_str(), base_median, cand_median, speedup, lo, hi, p,
+           verdict);
+  }
+  for (const auto& [name, baseline] : base) {
+    if (cand.count(name) == 0)
+      printf("%-12s %s\n", name.c_str(), "skipped (not in candidate)");
+  }
+  if (regressions > 0)
+    printf("\n%d benchmark(s) failed or regressed by more than %g%%\n",
+           regressions, threshold);
+  return regressions > 0 ? 1 : 0;
+}
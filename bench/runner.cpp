@@ -0,0 +1,239 @@
+// Runs the programs of a benchmark directory with a linaro binary and writes
+// the results as JSON: the wall time of every run with its median and
+// median absolute deviation, the peak RSS, and the bytecode instructions
+// executed when the binary was built with LINARO_PROFILE (null otherwise).
+// linaro_bench_compare tells whether two of them differ, see compare.cpp.
+//
+// usage: linaro_bench_runner <linaro> <bench dir> [--warmup n] [--reps n]
+//                            [--filter text] [-o results.json]
+//
+// Besides the *.lo files of the directory it runs frontend.lo, a large
+// generated program that mostly measures lexing, parsing and code
+// generation.
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Functions in the generated front-end program.
+const int FRONTEND_FUNCTIONS = 2000;
+
+struct Run {
+  bool ok;
+  double seconds;
+  long peak_rss_kb;
+};
+
+struct Result {
+  std::string name;
+  std::vector<double> runs;
+  long peak_rss_kb = 0;
+  long long instructions = -1;
+  bool failed = false;
+};
+
+// Runs 'args' with its output thrown away.
+static Run runProcess(const std::vector<std::string>& args) {
+  std::vector<char*> argv;
+  for (const std::string& arg : args) argv.push_back((char*)arg.c_str());
+  argv.push_back(nullptr);
+
+  auto start = std::chrono::steady_clock::now();
+  pid_t pid = fork();
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    execv(argv[0], argv.data());
+    _exit(127);
+  }
+  int status = 0;
+  struct rusage usage = {};
+  if (pid < 0 || wait4(pid, &status, 0, &usage) < 0) return {false, 0, 0};
+  auto end = std::chrono::steady_clock::now();
+  return {WIFEXITED(status) && WEXITSTATUS(status) == 0,
+          std::chrono::duration<double>(end - start).count(), usage.ru_maxrss};
+}
+
+static double median(std::vector<double> values) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  size_t n = values.size();
+  return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+static double medianAbsoluteDeviation(const std::vector<double>& values) {
+  double m = median(values);
+  std::vector<double> deviations;
+  for (double value : values) deviations.push_back(std::abs(value - m));
+  return median(deviations);
+}
+
+// Bytecode instructions of a run with the profiler, -1 without it.
+static long long countInstructions(const std::string& linaro,
+                                   const std::string& script) {
+  std::string json = (fs::temp_directory_path() /
+                      ("linaro_bench_" + std::to_string(getpid())) /
+                      "profile.json")
+                         .string();
+  long long instructions = -1;
+  if (runProcess({linaro, "--profile-json", json, script}).ok) {
+    std::ifstream in(json);
+    std::stringstream text;
+    text << in.rdbuf();
+    std::string key = "\"instructions\": ";
+    size_t at = text.str().find(key);
+    if (at != std::string::npos)
+      instructions = std::atoll(text.str().c_str() + at + key.size());
+  }
+  fs::remove(json);
+  return instructions;
+}
+
+static void writeFrontend(const std::string& path) {
+  std::ofstream out(path);
+  for (int k = 0; k < FRONTEND_FUNCTIONS; k++) {
+    out << "fn f" << k << "(a, b) {\n"
+        << "  x = a * " << k << " + b\n"
+        << "  y = " << k % 7 << "\n"
+        << "  while (y < 10) {\n"
+        << "    x = x + y * 2 - (a % 3)\n"
+        << "    y = y + 1\n"
+        << "  }\n"
+        << "  if (x > " << k << ") {\n"
+        << "    ret x - b\n"
+        << "  }\n"
+        << "  s = \"name" << k << "\" + \"-tail\"\n"
+        << "  arr = {a, b, x, y}\n"
+        << "  ret arr[2] + y\n"
+        << "}\n";
+  }
+  out << "print f0(1, 2) + f" << FRONTEND_FUNCTIONS - 1 << "(3, 4)\n"
+      << "print \"\\n\"\n";
+}
+
+static void writeJson(std::ostream& out, const std::string& linaro, int warmup,
+                      int reps, const std::vector<Result>& results) {
+  out.precision(9);
+  out << "{\n  \"linaro\": \"" << linaro << "\",\n"
+      << "  \"warmup\": " << warmup << ",\n  \"reps\": " << reps << ",\n"
+      << "  \"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result& result = results[i];
+    out << (i == 0 ? "" : ",") << "\n    {\"name\": \"" << result.name
+        << "\", \"failed\": " << (result.failed ? "true" : "false")
+        << ", \"runs\": [";
+    for (size_t r = 0; r < result.runs.size(); r++) {
+      out << (r == 0 ? "" : ", ") << result.runs[r];
+    }
+    out << "], \"median\": " << median(result.runs)
+        << ", \"mad\": " << medianAbsoluteDeviation(result.runs)
+        << ", \"instructions\": ";
+    if (result.instructions < 0)
+      out << "null";
+    else
+      out << result.instructions;
+    out << ", \"peak_rss_kb\": " << result.peak_rss_kb << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+static void usage() {
+  std::cerr << "usage: linaro_bench_runner <linaro> <bench dir> [--warmup n] "
+               "[--reps n]\n"
+            << "                           [--filter text] [-o results.json]\n";
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    usage();
+    return 2;
+  }
+  std::string linaro = fs::absolute(argv[1]).string();
+  std::string dir = argv[2];
+  int warmup = 1;
+  int reps = 5;
+  std::string filter;
+  std::string output;
+  for (int i = 3; i < argc; i++) {
+    if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+      warmup = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+      reps = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else {
+      usage();
+      return 2;
+    }
+  }
+
+  std::vector<std::string> scripts;
+  for (const auto& entry : fs::directory_iterator(dir)) {
+    if (entry.path().extension() == ".lo") scripts.push_back(entry.path());
+  }
+  fs::path tmp = fs::temp_directory_path() /
+                 ("linaro_bench_" + std::to_string(getpid()));
+  fs::create_directories(tmp);
+  std::string frontend = (tmp / "frontend.lo").string();
+  writeFrontend(frontend);
+  scripts.push_back(frontend);
+  std::sort(scripts.begin(), scripts.end(),
+            [](const std::string& a, const std::string& b) {
+              return fs::path(a).stem() < fs::path(b).stem();
+            });
+
+  std::vector<Result> results;
+  bool failed = false;
+  fprintf(stderr, "%-12s %10s %10s %14s %10s\n", "benchmark", "median s",
+          "mad s", "instructions", "rss kB");
+  for (const std::string& script : scripts) {
+    Result result;
+    result.name = fs::path(script).stem().string();
+    if (result.name.find(filter) == std::string::npos) continue;
+    for (int i = 0; i < warmup + reps; i++) {
+      Run run = runProcess({linaro, script});
+      if (!run.ok) {
+        result.failed = true;
+        break;
+      }
+      if (i < warmup) continue;
+      result.runs.push_back(run.seconds);
+      result.peak_rss_kb = std::max(result.peak_rss_kb, run.peak_rss_kb);
+    }
+    if (!result.failed) result.instructions = countInstructions(linaro, script);
+    failed = failed || result.failed;
+    fprintf(stderr, "%-12s %10.4f %10.4f %14lld %10ld%s\n", result.name.c_str(),
+            median(result.runs), medianAbsoluteDeviation(result.runs),
+            result.instructions, result.peak_rss_kb,
+            result.failed ? "  FAILED" : "");
+    results.push_back(std::move(result));
+  }
+  fs::remove_all(tmp);
+
+  if (output.empty()) {
+    writeJson(std::cout, linaro, warmup, reps, results);
+  } else {
+    std::ofstream out(output);
+    writeJson(out, linaro, warmup, reps, results);
+  }
+  return failed ? 1 : 0;
+}
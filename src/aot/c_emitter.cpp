@@ -0,0 +1,245 @@
+#include "c_emitter.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <set>
+
+#include "../vm/natives.h"
+
+namespace Linaro {
+
+#define BYTECODE(name) #name,
+static const char* const bytecode_names[]{
+#include "../code_generator/bytecodes.h"
+};
+#undef BYTECODE
+
+bool CEmitter::emit(Function* top_level, const char* source_name,
+                    std::ostream& out) {
+  CHECK(top_level != nullptr);
+  CEmitter emitter(out);
+  emitter.collectFunctions(top_level);
+
+  out << "/* Generated by linaro --emit-c from " << source_name << ". */\n\n"
+      << "#include \"runtime.h\"\n\n";
+  for (size_t i = 0; i < emitter.m_functions.size(); i++) {
+    out << "static int fn_" << i << "(LrRuntime* rt);\n";
+  }
+  out << '\n';
+
+  for (size_t i = 0; i < emitter.m_functions.size(); i++) {
+    Function* fn = emitter.m_functions[i];
+    if (fn->numCapturedVariables() == 0) continue;
+    out << "static const int captured_" << i << "[] = {";
+    for (const auto& captured : fn->getCapturedVariables()) {
+      out << captured.index << ", " << captured.is_local << ", ";
+    }
+    out << "};\n";
+  }
+
+  out << "static const LrFunction functions[] = {\n";
+  for (size_t i = 0; i < emitter.m_functions.size(); i++) {
+    Function* fn = emitter.m_functions[i];
+    out << "    {";
+    emitter.emitString(std::string(fn->name()));
+    out << ", " << fn->numArgs() << ", " << fn->numLocals() << ", "
+        << fn->numCapturedVariables() << ", ";
+    if (fn->numCapturedVariables() == 0)
+      out << "0";
+    else
+      out << "captured_" << i;
+    out << ", fn_" << i << "},\n";
+  }
+  out << "};\n\n";
+
+  for (size_t i = 0; i < emitter.m_functions.size(); i++) {
+    if (!emitter.emitFunction(i)) return false;
+  }
+
+  out << "int linaro_script_run(void) {\n"
+      << "  return lr_run(functions, " << emitter.m_functions.size() << ", "
+      << top_level->numLocals() << ");\n"
+      << "}\n\n"
+      << "#ifndef LINARO_AOT_NO_MAIN\n"
+      << "int main(void) { return linaro_script_run(); }\n"
+      << "#endif\n";
+  return true;
+}
+
+void CEmitter::collectFunctions(Function* fn) {
+  m_function_index[fn] = m_functions.size();
+  m_functions.push_back(fn);
+  for (const Value& val : fn->constants()) {
+    if (val.isFunction()) collectFunctions(&val.valueTo<Function>());
+  }
+}
+
+bool CEmitter::emitFunction(int index) {
+  Function* fn = m_functions[index];
+  BytecodeChunk* code = fn->code();
+
+  std::set<uint32_t> labels;
+  for (uint32_t i = 0; i < code->chunkSize();) {
+    Bytecode op = static_cast<Bytecode>(code->readByte(i));
+    if (BytecodeChunk::isJump(op)) labels.insert(code->read16Bits(i + 1));
+    i += BytecodeChunk::instructionSize(op);
+  }
+
+  m_out << "/* " << fn->name() << " */\n"
+        << "static int fn_" << index << "(LrRuntime* rt) {\n";
+  for (uint32_t i = 0; i < code->chunkSize();) {
+    Bytecode op = static_cast<Bytecode>(code->readByte(i));
+    uint16_t operand = 0;
+    if (BytecodeChunk::getNumArguments(op) > 0)
+      operand = code->read16Bits(i + 1);
+    if (labels.count(i)) m_out << "L" << i << ":;\n";
+
+    switch (op) {
+      case Bytecode::nop:
+        break;
+      case Bytecode::jmp:
+      case Bytecode::jmp_loop:
+        m_out << "  goto L" << operand << ";\n";
+        break;
+      case Bytecode::jmp_true:
+      case Bytecode::jmp_false:
+        // The condition stays on the stack if the jump is made.
+        m_out << "  if (" << (op == Bytecode::jmp_false ? "!" : "")
+              << "lr_truthy(rt)) goto L" << operand << ";\n"
+              << "  lr_pop(rt);\n";
+        break;
+      case Bytecode::for_prep:
+        m_out << "  switch (lr_for_prep(rt, " << code->read16Bits(i + 3)
+              << ")) {\n"
+              << "    case -1: return 1;\n"
+              << "    case 0: goto L" << operand << ";\n"
+              << "  }\n";
+        break;
+      case Bytecode::for_step:
+        m_out << "  if (lr_for_step(rt, " << code->read16Bits(i + 3)
+              << ")) goto L" << operand << ";\n";
+        break;
+      case Bytecode::constant:
+        if (!emitConstant(fn, operand)) return false;
+        break;
+      case Bytecode::gload:
+        // The runtime has no scheduler, isolates or actors to run the
+        // built-in functions on.
+        if (operand < Natives::count()) {
+          fprintf(stderr, "Can't emit the built-in '%s' in %s as C.\n",
+                  Natives::names[operand], std::string(fn->name()).c_str());
+          return false;
+        }
+        m_out << "  lr_gload(rt, " << operand << ");\n";
+        break;
+      case Bytecode::gstore:
+      case Bytecode::load:
+      case Bytecode::store:
+      case Bytecode::cload:
+      case Bytecode::cstore:
+      case Bytecode::new_array:
+        m_out << "  lr_" << bytecode_names[(int)op] << "(rt, " << operand
+              << ");\n";
+        break;
+      case Bytecode::closure:
+        m_out << "  lr_closure(rt, "
+              << m_function_index.at(
+                     &fn->getConstant(operand).valueTo<Function>())
+              << ");\n";
+        break;
+      case Bytecode::call_tos:
+        m_out << "  if (lr_call(rt, " << operand << ")) return 1;\n";
+        break;
+      case Bytecode::aload:
+      case Bytecode::astore:
+        m_out << "  if (lr_" << bytecode_names[(int)op]
+              << "(rt)) return 1;\n";
+        break;
+      case Bytecode::ret:
+      case Bytecode::halt:
+        m_out << "  return 0;\n";
+        break;
+      case Bytecode::new_obj:
+      case Bytecode::call:
+      case Bytecode::invoke_inline:
+      case Bytecode::spawn:
+      case Bytecode::join:
+      case Bytecode::parallel_for:
+        fprintf(stderr, "Can't emit '%s' in %s as C.\n",
+                bytecode_names[(int)op], std::string(fn->name()).c_str());
+        return false;
+      default: {
+        // The rest take no operands and have a runtime function of the same
+        // name.
+        std::string name = bytecode_names[(int)op];
+        for (char& c : name) c = tolower(c);
+        m_out << "  lr_" << name << "(rt);\n";
+      }
+    }
+    i += BytecodeChunk::instructionSize(op);
+  }
+  m_out << "}\n\n";
+  return true;
+}
+
+bool CEmitter::emitConstant(Function* fn, uint16_t index) {
+  const Value& val = fn->getConstant(index);
+  if (val.isNumber()) {
+    double d = val.asNumber();
+    m_out << "  lr_number(rt, ";
+    if (std::isnan(d)) {
+      m_out << "0.0 / 0.0";
+    } else if (std::isinf(d)) {
+      m_out << (d < 0 ? "-1.0 / 0.0" : "1.0 / 0.0");
+    } else {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%.17g", d);
+      m_out << buf;
+    }
+    m_out << ");\n";
+  } else if (val.isString()) {
+    std::string str = val.asString();
+    m_out << "  lr_string(rt, ";
+    emitString(str);
+    m_out << ", " << str.size() << ");\n";
+  } else if (val.isBoolean()) {
+    m_out << (val.asBoolean() ? "  lr_true(rt);\n" : "  lr_false(rt);\n");
+  } else {
+    fprintf(stderr, "Can't emit constant %d of %s as C.\n", index,
+            std::string(fn->name()).c_str());
+    return false;
+  }
+  return true;
+}
+
+void CEmitter::emitString(const std::string& str) {
+  m_out << '"';
+  for (unsigned char c : str) {
+    switch (c) {
+      case '"':
+        m_out << "\\\"";
+        break;
+      case '\\':
+        m_out << "\\\\";
+        break;
+      case '\n':
+        m_out << "\\n";
+        break;
+      case '\t':
+        m_out << "\\t";
+        break;
+      default:
+        if (isprint(c)) {
+          m_out << c;
+        } else {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\%03o", c);
+          m_out << buf;
+        }
+    }
+  }
+  m_out << '"';
+}
+
+}  // namespace Linaro
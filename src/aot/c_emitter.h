@@ -0,0 +1,39 @@
+#ifndef C_EMITTER_H
+#define C_EMITTER_H
+
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include "../vm/objects.h"
+
+namespace Linaro {
+
+// Translates compiled functions into a C translation unit that runs on the
+// runtime declared in runtime.h. Every bytecode becomes a call into the
+// runtime, and jumps become gotos.
+class CEmitter {
+ public:
+  // Emits 'top_level' and every function created from it. Returns false if
+  // some bytecode can't be translated, or a built-in function is used.
+  static bool emit(Function* top_level, const char* source_name,
+                   std::ostream& out);
+
+ private:
+  CEmitter(std::ostream& out) : m_out{out} {}
+
+  void collectFunctions(Function* fn);
+  bool emitFunction(int index);
+  bool emitConstant(Function* fn, uint16_t index);
+  void emitString(const std::string& str);
+
+  std::ostream& m_out;
+  // Functions in the order they appear in the function table. The top-level
+  // function is first.
+  std::vector<Function*> m_functions;
+  std::unordered_map<const Function*, int> m_function_index;
+};
+
+}  // namespace Linaro
+
+#endif  // C_EMITTER_H
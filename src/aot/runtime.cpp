@@ -0,0 +1,274 @@
+#include "runtime.h"
+
+#include <cmath>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "../linaro_utils/utils.h"
+#include "../vm/objects.h"
+#include "../vm/vm.h"
+
+using namespace Linaro;
+
+struct LrFrame {
+  LrFrame(Closure* closure, int num_locals)
+      : closure{closure}, locals(num_locals) {}
+  Closure* closure;
+  std::vector<Value> locals;
+};
+
+// Mirrors the parts of the VM that compiled code can't do by itself.
+struct LrRuntime {
+  std::vector<std::unique_ptr<Function>> functions;
+  std::unordered_map<const Function*, const LrFunction*> code;
+  Stack<Value> stack;
+  std::vector<LrFrame> frames;
+  std::vector<Value> globals;
+  // Strings are created once per literal, like constants in the VM.
+  std::unordered_map<const char*, Value> strings;
+  std::vector<std::shared_ptr<CapturedVariable>> open_captured_variables;
+
+  LrFrame& frame() { return frames.back(); }
+
+  void runtimeError(const char* message) {
+    std::cerr << Error::errorToString[Error::RuntimeError] << " " << message
+              << '\n';
+    stack.reset();
+  }
+
+  std::shared_ptr<CapturedVariable> captureVariable(int index) {
+    Value* val = &frame().locals[index];
+    for (const auto& cv : open_captured_variables) {
+      if (cv->val == val) return cv;
+    }
+    open_captured_variables.push_back(
+        makeObject<CapturedVariable>(CapturedVariable{val, Value()}));
+    return open_captured_variables.back();
+  }
+
+  void returnFromFunction() {
+    // Close the variables captured from the returning frame.
+    std::vector<Value>& locals = frame().locals;
+    auto& open = open_captured_variables;
+    for (size_t i = 0; i < open.size();) {
+      CapturedVariable* cv = open[i].get();
+      if (cv->val >= locals.data() && cv->val < locals.data() + locals.size()) {
+        cv->closed = *cv->val;
+        cv->val = &cv->closed;
+        open[i] = open.back();
+        open.pop_back();
+      } else {
+        i++;
+      }
+    }
+    frames.pop_back();
+  }
+};
+
+extern "C" {
+
+int lr_run(const LrFunction* functions, int num_functions, int num_globals) {
+  LrRuntime rt;
+  for (int i = 0; i < num_functions; i++) {
+    const LrFunction& fn = functions[i];
+    auto function = std::make_unique<Function>(nullptr, fn.name, fn.num_args);
+    function->setNumLocals(fn.num_locals);
+    for (int j = 0; j < fn.num_captured; j++) {
+      function->addCapturedVariable(fn.captured[2 * j],
+                                    fn.captured[2 * j + 1]);
+    }
+    rt.code[function.get()] = &fn;
+    rt.functions.push_back(std::move(function));
+  }
+  rt.globals.resize(num_globals);
+
+  Closure top_level(rt.functions[0].get());
+  rt.frames.emplace_back(&top_level, functions[0].num_locals);
+  int res = functions[0].code(&rt);
+  if (res == 0) rt.returnFromFunction();
+  return res;
+}
+
+void lr_pop(LrRuntime* rt) { rt->stack.pop_back(); }
+void lr_dup(LrRuntime* rt) { rt->stack.push(rt->stack.peek()); }
+int lr_truthy(LrRuntime* rt) { return rt->stack.peek().asBoolean(); }
+
+void lr_number(LrRuntime* rt, double d) { rt->stack.push(Value(d)); }
+void lr_string(LrRuntime* rt, const char* str, int length) {
+  auto it = rt->strings.find(str);
+  if (it == rt->strings.end()) {
+    Value val(makeObject<String>(std::string_view(str, length)));
+    it = rt->strings.insert({str, val}).first;
+  }
+  rt->stack.push(it->second);
+}
+void lr_true(LrRuntime* rt) { rt->stack.push(Value(true)); }
+void lr_false(LrRuntime* rt) { rt->stack.push(Value(false)); }
+void lr_null(LrRuntime* rt) { rt->stack.push(Value(ValueType::nNoll)); }
+void lr_new_array(LrRuntime* rt, int size) {
+  auto arr = makeObject<Array>();
+  for (double i = 0; i < size; i++) {
+    arr->insert(Value(i), rt->stack.pop());
+  }
+  rt->stack.push(Value(arr));
+}
+
+void lr_incr(LrRuntime* rt) {
+  rt->stack.peek() = rt->stack.peek() + 1.0;
+}
+void lr_decr(LrRuntime* rt) {
+  rt->stack.peek() = rt->stack.peek() - 1.0;
+}
+
+#define BINARY_OPERATION(name, expr) \
+  void lr_##name(LrRuntime* rt) {    \
+    Value op2 = rt->stack.pop();     \
+    Value op1 = rt->stack.pop();     \
+    rt->stack.push(expr);            \
+  }
+BINARY_OPERATION(add, op1 + op2)
+BINARY_OPERATION(sub, op1 - op2)
+BINARY_OPERATION(mod, op1 % op2)
+BINARY_OPERATION(mul, op1 * op2)
+BINARY_OPERATION(div, op1 / op2)
+BINARY_OPERATION(exp, Value::power(op1, op2))
+BINARY_OPERATION(neq, !Value::equal(op1, op2))
+BINARY_OPERATION(eq, Value::equal(op1, op2))
+BINARY_OPERATION(lt, Value::compare(op1, op2) == Value::lt)
+BINARY_OPERATION(lte, Value::compare(op1, op2) == Value::lt ||
+                          Value::compare(op1, op2) == Value::eq)
+BINARY_OPERATION(gt, Value::compare(op1, op2) == Value::gt)
+BINARY_OPERATION(gte, Value::compare(op1, op2) == Value::gt ||
+                          Value::compare(op1, op2) == Value::eq)
+#undef BINARY_OPERATION
+
+void lr_neg(LrRuntime* rt) {
+  rt->stack.peek() = -rt->stack.peek().asNumber();
+}
+void lr_not(LrRuntime* rt) {
+  rt->stack.peek() = !rt->stack.peek().asBoolean();
+}
+void lr_to_bool(LrRuntime* rt) {
+  rt->stack.peek() = rt->stack.peek().asBoolean();
+}
+
+void lr_incr_num(LrRuntime* rt) { rt->stack.peek().rawNumber() += 1; }
+void lr_decr_num(LrRuntime* rt) { rt->stack.peek().rawNumber() -= 1; }
+void lr_neg_num(LrRuntime* rt) {
+  double& num = rt->stack.peek().rawNumber();
+  num = -num;
+}
+
+#define NUMBER_OPERATION(name, expr)                  \
+  void lr_##name(LrRuntime* rt) {                     \
+    double op2 = rt->stack.peek().rawNumber();        \
+    rt->stack.pop_back();                             \
+    Value& result = rt->stack.peek();                 \
+    double& op1 = result.rawNumber();                 \
+    expr;                                             \
+  }
+NUMBER_OPERATION(add_num, op1 += op2)
+NUMBER_OPERATION(sub_num, op1 -= op2)
+NUMBER_OPERATION(mod_num, op1 = fmod(op1, op2))
+NUMBER_OPERATION(mul_num, op1 *= op2)
+NUMBER_OPERATION(div_num, op1 /= op2)
+NUMBER_OPERATION(lt_num, result = op1 - op2 < 0)
+NUMBER_OPERATION(lte_num, result = !(op1 - op2 > 0))
+NUMBER_OPERATION(gt_num, result = op1 - op2 > 0)
+NUMBER_OPERATION(gte_num, result = !(op1 - op2 < 0))
+#undef NUMBER_OPERATION
+
+void lr_gload(LrRuntime* rt, int i) { rt->stack.push(rt->globals[i]); }
+void lr_gstore(LrRuntime* rt, int i) { rt->globals[i] = rt->stack.peek(); }
+void lr_load(LrRuntime* rt, int i) {
+  rt->stack.push(rt->frame().locals[i]);
+}
+void lr_store(LrRuntime* rt, int i) {
+  rt->frame().locals[i] = rt->stack.pop();
+}
+void lr_cload(LrRuntime* rt, int i) {
+  rt->stack.push(*rt->frame().closure->getCapturedVariable(i)->val);
+}
+void lr_cstore(LrRuntime* rt, int i) {
+  *rt->frame().closure->getCapturedVariable(i)->val = rt->stack.pop();
+}
+
+int lr_for_prep(LrRuntime* rt, int counter) {
+  Value end = rt->stack.pop();
+  Value start = rt->stack.pop();
+  if (!start.isNumber() || !end.isNumber()) {
+    rt->runtimeError("Attempted looping over a range that isn't numbers.");
+    return -1;
+  }
+  Value* locals = &rt->frame().locals[counter];
+  locals[0] = start;
+  locals[1] = end;
+  return start.asNumber() < end.asNumber();
+}
+int lr_for_step(LrRuntime* rt, int counter) {
+  Value* locals = &rt->frame().locals[counter];
+  return ++locals[0].rawNumber() < locals[1].rawNumber();
+}
+
+int lr_aload(LrRuntime* rt) {
+  Value key = rt->stack.pop();
+  Value arr = rt->stack.pop();
+  if (!arr.isArray()) {
+    rt->runtimeError("Attempted array access [expr] was not an array.");
+    return 1;
+  }
+  rt->stack.push(arr.valueTo<Array>().get(key));
+  return 0;
+}
+int lr_astore(LrRuntime* rt) {
+  Value key = rt->stack.pop();
+  Value arr = rt->stack.pop();
+  if (!arr.isArray()) {
+    rt->runtimeError("Attempted array access [expr] was not an array.");
+    return 1;
+  }
+  arr.valueTo<Array>().insert(key, rt->stack.pop());
+  return 0;
+}
+
+void lr_print(LrRuntime* rt) { std::cout << rt->stack.pop(); }
+
+void lr_closure(LrRuntime* rt, int function) {
+  Function* fn = rt->functions[function].get();
+  auto closure = makeObject<Closure>(fn);
+  for (int i = 0; i < fn->numCapturedVariables(); i++) {
+    CompilerCapturedVariable* captured = fn->getCapturedVariable(i);
+    if (captured->is_local) {
+      closure->addCapturedVariable(rt->captureVariable(captured->index));
+    } else {
+      auto& enclosing = rt->frame().closure->getCapturedVariables();
+      closure->addCapturedVariable(enclosing[captured->index]);
+    }
+  }
+  rt->stack.push(Value(closure));
+}
+
+int lr_call(LrRuntime* rt, int num_args) {
+  Value callee = rt->stack.pop();
+  if (!callee.isClosure()) {
+    rt->runtimeError("Attempted invoking non-callable object.");
+    return 1;
+  }
+  Closure& closure = callee.valueTo<Closure>();
+  const LrFunction* fn = rt->code.at(closure.fun());
+  rt->frames.emplace_back(&closure, fn->num_locals);
+  // Missing arguments are undefined, extra ones are dropped.
+  for (int i = 0; i < num_args; i++) {
+    if (i < fn->num_args)
+      rt->frame().locals[i] = rt->stack.pop();
+    else
+      rt->stack.pop();
+  }
+  int res = fn->code(rt);
+  if (res != 0) return res;
+  rt->returnFromFunction();
+  return 0;
+}
+
+}  // extern "C"
@@ -0,0 +1,107 @@
+#ifndef LINARO_RUNTIME_H
+#define LINARO_RUNTIME_H
+
+/* Runtime used by C code generated with 'linaro --emit-c'. Every function
+ * operates on the operand stack and the top call frame of the runtime, and
+ * has the same semantics as the bytecode of the same name in VM::execute. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct LrRuntime LrRuntime;
+
+/* Compiled code of a function. Returns 0 once the function has returned,
+ * its return value is on top of the operand stack. */
+typedef int (*LrCode)(LrRuntime* rt);
+
+typedef struct LrFunction {
+  const char* name;
+  int num_args;
+  int num_locals;
+  /* (index, is_local) pairs, see CompilerCapturedVariable. */
+  int num_captured;
+  const int* captured;
+  LrCode code;
+} LrFunction;
+
+/* Runs 'functions[0]' as the top-level function. 'functions' must stay
+ * alive while the script runs. Returns non-zero on a runtime error. */
+int lr_run(const LrFunction* functions, int num_functions, int num_globals);
+
+/* Operand stack */
+void lr_pop(LrRuntime* rt);
+void lr_dup(LrRuntime* rt);
+int lr_truthy(LrRuntime* rt);
+
+/* rvalues */
+void lr_number(LrRuntime* rt, double d);
+void lr_string(LrRuntime* rt, const char* str, int length);
+void lr_true(LrRuntime* rt);
+void lr_false(LrRuntime* rt);
+void lr_null(LrRuntime* rt);
+void lr_new_array(LrRuntime* rt, int size);
+
+/* Arithmetic, comparisons and conversions */
+void lr_incr(LrRuntime* rt);
+void lr_decr(LrRuntime* rt);
+void lr_add(LrRuntime* rt);
+void lr_sub(LrRuntime* rt);
+void lr_mod(LrRuntime* rt);
+void lr_mul(LrRuntime* rt);
+void lr_div(LrRuntime* rt);
+void lr_exp(LrRuntime* rt);
+void lr_neg(LrRuntime* rt);
+void lr_neq(LrRuntime* rt);
+void lr_eq(LrRuntime* rt);
+void lr_lt(LrRuntime* rt);
+void lr_lte(LrRuntime* rt);
+void lr_gt(LrRuntime* rt);
+void lr_gte(LrRuntime* rt);
+void lr_not(LrRuntime* rt);
+void lr_to_bool(LrRuntime* rt);
+
+/* Operands proven to be numbers */
+void lr_incr_num(LrRuntime* rt);
+void lr_decr_num(LrRuntime* rt);
+void lr_add_num(LrRuntime* rt);
+void lr_sub_num(LrRuntime* rt);
+void lr_mod_num(LrRuntime* rt);
+void lr_mul_num(LrRuntime* rt);
+void lr_div_num(LrRuntime* rt);
+void lr_neg_num(LrRuntime* rt);
+void lr_lt_num(LrRuntime* rt);
+void lr_lte_num(LrRuntime* rt);
+void lr_gt_num(LrRuntime* rt);
+void lr_gte_num(LrRuntime* rt);
+
+/* Variables */
+void lr_gload(LrRuntime* rt, int i);
+void lr_gstore(LrRuntime* rt, int i);
+void lr_load(LrRuntime* rt, int i);
+void lr_store(LrRuntime* rt, int i);
+void lr_cload(LrRuntime* rt, int i);
+void lr_cstore(LrRuntime* rt, int i);
+
+/* Numeric for loops. lr_for_prep returns 1 if the loop runs, 0 if the
+ * range is empty and -1 on a runtime error. lr_for_step returns 1 if the
+ * loop runs again. */
+int lr_for_prep(LrRuntime* rt, int counter);
+int lr_for_step(LrRuntime* rt, int counter);
+
+/* Arrays. Return non-zero on a runtime error. */
+int lr_aload(LrRuntime* rt);
+int lr_astore(LrRuntime* rt);
+
+/* Built-in functions */
+void lr_print(LrRuntime* rt);
+
+/* Functions */
+void lr_closure(LrRuntime* rt, int function);
+int lr_call(LrRuntime* rt, int num_args);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LINARO_RUNTIME_H */
@@ -31,6 +31,7 @@ bool Expression::toBooleanIsFalse() {
   return isLiteral() && !asLiteral()->value().asBoolean();
 }
 
+#ifdef DEBUG
 void FunctionLiteral::printNode() const {
   std::cout << "FunctionLiteral: {\n";
   std::cout << "Name: " << m_function_name << '\n';
@@ -44,6 +45,7 @@ void FunctionLiteral::printNode() const {
   std::cout << "\n";
   std::cout << "} // End of FunctionLiteral: " << m_function_name << "\n";
 }
+#endif
 
 // This needs some fixing probably
 bool BinaryOperation::isValidReferenceExpression() {
@@ -31,7 +31,8 @@ namespace Linaro {
   T(PrintStatement)       \
   T(FunctionDeclaration)  \
   T(IfStatement)          \
-  T(WhileStatement)
+  T(WhileStatement)       \
+  T(ForStatement)
 
 // Base class for all nodes
 class Node;
@@ -85,10 +86,14 @@ class Node {
   virtual void printNode() const = 0;
 #endif
 
+  // Nodes the calling thread has created so far.
+  static uint64_t numCreated() { return s_num_created; }
+
  protected:
-  Node(NodeType type) : m_type(type) {}
+  Node(NodeType type) : m_type(type) { s_num_created++; }
 
  private:
+  static inline thread_local uint64_t s_num_created = 0;
   NodeType m_type;
 };
 
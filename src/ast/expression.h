@@ -68,9 +68,11 @@ enum class FunctionType { anonymous, named, method, constructor, top_level };
 
 class FunctionLiteral : public Expression {
  public:
-  FunctionLiteral(FunctionType type, std::string_view name,
-                  const std::vector<Identifier>& args, BlockPtr& block)
+  FunctionLiteral(const Location& loc, FunctionType type,
+                  std::string_view name, const std::vector<Identifier>& args,
+                  BlockPtr& block)
       : Expression(nFunctionLiteral),
+        m_loc(loc),
         m_type(type),
         m_function_name(name),
         m_args(std::move(args)),
@@ -86,6 +88,7 @@ class FunctionLiteral : public Expression {
   const auto& args() const { return m_args; }
   int numArgs() const { return m_args.size(); }
   std::string_view name() const { return m_function_name; }
+  const Location& loc() const { return m_loc; }
 
   void visit(NodeVisitor& v) override { v.visitFunctionLiteral(*this); }
 
@@ -94,6 +97,7 @@ class FunctionLiteral : public Expression {
 #endif
 
  private:
+  Location m_loc;
   FunctionType m_type;
   std::string_view m_function_name;
   std::vector<Identifier> m_args;
@@ -102,7 +106,8 @@ class FunctionLiteral : public Expression {
 
 class ArrayLiteral : public Expression {
  public:
-  ArrayLiteral() : Expression(nArrayLiteral) {}
+  explicit ArrayLiteral(const Location& loc)
+      : Expression(nArrayLiteral), m_loc(loc) {}
 
   void addElement(ExpressionPtr element) {
     m_elements.push_back(std::move(element));
@@ -110,6 +115,7 @@ class ArrayLiteral : public Expression {
 
   int size() const { return m_elements.size(); }
   const auto& elements() const { return m_elements; }
+  const Location& loc() const { return m_loc; }
 
   void visit(NodeVisitor& v) override { v.visitArrayLiteral(*this); }
 
@@ -128,6 +134,7 @@ class ArrayLiteral : public Expression {
 #endif
 
  private:
+  Location m_loc;
   std::vector<ExpressionPtr> m_elements;
 };
 
@@ -287,16 +294,19 @@ class Assignment : public Expression {
   ExpressionPtr m_right;
 };
 
-// If I will need call types in the future, introduce sub classes to Call
-// for each type instead. Keep common things in the Call class.
+// f(args), f&(args) spawns a fiber running f and evaluates to its handle,
+// and t#() joins the fiber t. f#(args) runs f in a fiber and joins it.
+enum class CallType { normal, spawn, join };
+
 class Call : public Expression {
  public:
-  Call(ExpressionPtr& caller)
-      : Expression(nCall), m_caller(std::move(caller)) {}
+  Call(ExpressionPtr& caller, CallType type = CallType::normal)
+      : Expression(nCall), m_caller(std::move(caller)), m_type{type} {}
 
   Call* asCall() { return this; }
   const auto& arguments() const { return m_args; }
   Expression* caller() const { return m_caller.get(); }
+  CallType type() const { return m_type; }
 
   void addArgument(ExpressionPtr arg) { m_args.push_back(std::move(arg)); }
   bool isValidReferenceIdentifier();
@@ -305,7 +315,9 @@ class Call : public Expression {
 
 #ifdef DEBUG
   void printNode() const override {
-    std::cout << "FunctionCall(";
+    std::cout << (m_type == CallType::spawn  ? "SpawnCall("
+                  : m_type == CallType::join ? "JoinCall("
+                                             : "FunctionCall(");
     std::cout << "Caller: ";
     m_caller->printNode();
 
@@ -323,6 +335,7 @@ class Call : public Expression {
  private:
   ExpressionPtr m_caller;
   std::vector<ExpressionPtr> m_args;
+  CallType m_type;
 };
 
 }  // namespace Linaro
@@ -2,6 +2,7 @@
 #define STATEMENT_H
 
 #include <memory>
+#include <vector>
 
 #include "../parsing/token.h"
 #include "ast.h"
@@ -213,5 +214,65 @@ class WhileStatement : public Statement {
   BlockPtr m_while_block;
 };
 
+// How a parallel for loop combines the values a reduction variable gets in
+// the different parts of the range.
+enum class ReductionOp : uint8_t { add, mul, min, max };
+
+struct Reduction {
+  ReductionOp op;
+  Token variable;
+};
+
+// for i in start..end { ... } runs the block for i = start, start + 1, ...
+// while i < end. 'parallel for' splits the range between the workers, with
+// the reduction variables combined once every part is done.
+class ForStatement : public Statement {
+ public:
+  ForStatement(const Token& variable, ExpressionPtr& start, ExpressionPtr& end,
+               BlockPtr& block, bool is_parallel,
+               std::vector<Reduction> reductions)
+      : Statement(nForStatement),
+        m_variable(variable),
+        m_start(std::move(start)),
+        m_end(std::move(end)),
+        m_block(std::move(block)),
+        m_is_parallel(is_parallel),
+        m_reductions(std::move(reductions)) {}
+
+  const Token& variable() const { return m_variable; }
+  Expression* start() const { return m_start.get(); }
+  Expression* end() const { return m_end.get(); }
+  Block* block() const { return m_block.get(); }
+  bool isParallel() const { return m_is_parallel; }
+  const std::vector<Reduction>& reductions() const { return m_reductions; }
+
+  void visit(NodeVisitor& v) override { v.visitForStatement(*this); }
+
+#ifdef DEBUG
+  void printNode() const override {
+    std::cout << (m_is_parallel ? "Parallel_" : "") << "For_Statement["
+              << m_variable.asString() << " in (";
+    m_start->printNode();
+    std::cout << ")..(";
+    m_end->printNode();
+    std::cout << ")";
+    for (const Reduction& r : m_reductions) {
+      std::cout << " reduce " << (int)r.op << " " << r.variable.asString();
+    }
+    std::cout << " {";
+    m_block->printNode();
+    std::cout << "}]";
+  }
+#endif
+
+ private:
+  Token m_variable;
+  ExpressionPtr m_start;
+  ExpressionPtr m_end;
+  BlockPtr m_block;
+  bool m_is_parallel;
+  std::vector<Reduction> m_reductions;
+};
+
 }  // namespace Linaro
 #endif  // STATEMENT_H
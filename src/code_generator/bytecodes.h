@@ -21,6 +21,20 @@ BYTECODE(lte)
 BYTECODE(gt)
 BYTECODE(gte)
 
+/* Specialized versions for operands proven to be numbers */
+BYTECODE(incr_num)
+BYTECODE(decr_num)
+BYTECODE(add_num)
+BYTECODE(sub_num)
+BYTECODE(mod_num)
+BYTECODE(mul_num)
+BYTECODE(div_num)
+BYTECODE(neg_num)
+BYTECODE(lt_num)
+BYTECODE(lte_num)
+BYTECODE(gt_num)
+BYTECODE(gte_num)
+
 /* Logical */
 BYTECODE(NOT)
 
@@ -31,6 +45,13 @@ BYTECODE(to_bool)
 BYTECODE(jmp)
 BYTECODE(jmp_true)
 BYTECODE(jmp_false)
+BYTECODE(jmp_loop)  // Backwards jump of a loop (target, loop index)
+
+/* Numeric for loops. The counter and the end of the range are kept in two
+   consecutive locals. */
+BYTECODE(for_prep)      // Sets up the range on the stack (exit, counter)
+BYTECODE(for_step)      // Steps and jumps back (header, counter, loop index)
+BYTECODE(parallel_for)  // (reductions, reduction ops), see VM::parallelFor
 
 /* rvalues */
 BYTECODE(constant)
@@ -65,6 +86,11 @@ BYTECODE(ret)
 /* Functions calls */
 BYTECODE(call)      // Calls argument (index into constant pool)
 BYTECODE(call_tos)  // Calls top of operand stack
+BYTECODE(spawn)     // Runs top of operand stack in a new fiber
+BYTECODE(join)      // Waits for the fiber on top of operand stack
+
+/* Guarded entry into a callee spliced in by the inliner */
+BYTECODE(invoke_inline)
 
 /* Creates a closure for some function in the const pool */
 BYTECODE(closure)
@@ -1,9 +1,11 @@
 #include "chunk.h"
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 
 #include "../linaro_utils/common.h"
+#include "../parsing/token.h"
 
 namespace Linaro {
 
@@ -25,6 +27,63 @@ void BytecodeChunk::patchJump(Label& label, int extra_offset) {
   label.bindLabel(current_offset);
 }
 
+Location BytecodeChunk::getLocation(uint32_t offset) const {
+  auto run = std::upper_bound(
+      m_locations.begin(), m_locations.end(), offset,
+      [](uint32_t offset, const LocationRun& run) { return offset < run.offset; });
+  if (run == m_locations.begin()) return Location{"<unknown>", 0, 0};
+  --run;
+  return Location{run->file, run->line, run->col};
+}
+
+void BytecodeChunk::setLocation(const Location& loc) {
+  uint32_t offset = m_code.size();
+  if (!m_locations.empty()) {
+    LocationRun& last = m_locations.back();
+    if (last.file == loc.file && last.line == loc.line && last.col == loc.col)
+      return;
+    // Nothing was added at the last location.
+    if (last.offset == offset) {
+      last = {offset, loc.file, loc.line, loc.col};
+      return;
+    }
+  }
+  m_locations.push_back({offset, loc.file, loc.line, loc.col});
+}
+
+int BytecodeChunk::getNumArguments(Bytecode op) {
+  CHECK(op < Bytecode::NUM_BYTECODES);
+  switch (op) {
+    case Bytecode::jmp:
+    case Bytecode::jmp_true:
+    case Bytecode::jmp_false:
+    case Bytecode::constant:
+    case Bytecode::new_obj:
+    case Bytecode::gload:
+    case Bytecode::gstore:
+    case Bytecode::call:
+    case Bytecode::call_tos:
+    case Bytecode::spawn:
+    case Bytecode::join:
+    case Bytecode::invoke_inline:
+    case Bytecode::closure:
+    case Bytecode::load:
+    case Bytecode::store:
+    case Bytecode::cload:
+    case Bytecode::cstore:
+    case Bytecode::new_array:
+      return 1;
+    case Bytecode::jmp_loop:
+    case Bytecode::for_prep:
+    case Bytecode::parallel_for:
+      return 2;
+    case Bytecode::for_step:
+      return 3;
+    default:
+      return 0;
+  }
+}
+
 #ifdef DEBUG
 void BytecodeChunk::disassembleChunk() const {
   for (unsigned i = 0; i < m_code.size();) {
@@ -48,6 +107,11 @@ void BytecodeChunk::disassembleBytecode(Bytecode op, unsigned* i) const {
       printf(" %d %d", read16Bits(*i), read16Bits(*i + 2));
       *i += 4;
       break;
+    case 3:
+      printf(" %d %d %d", read16Bits(*i), read16Bits(*i + 2),
+             read16Bits(*i + 4));
+      *i += 6;
+      break;
     default:
       UNREACHABLE();
   }
@@ -59,29 +123,6 @@ const char* BytecodeChunk::bytecodeToString(Bytecode op) {
   return bytecode_to_string[(uint8_t)op];
 }
 
-int BytecodeChunk::getNumArguments(Bytecode op) const {
-  CHECK(op < Bytecode::NUM_BYTECODES);
-  switch (op) {
-    case Bytecode::jmp:
-    case Bytecode::jmp_true:
-    case Bytecode::jmp_false:
-    case Bytecode::constant:
-    case Bytecode::new_obj:
-    case Bytecode::gload:
-    case Bytecode::gstore:
-    case Bytecode::call:
-    case Bytecode::call_tos:
-    case Bytecode::closure:
-    case Bytecode::load:
-    case Bytecode::store:
-    case Bytecode::cload:
-    case Bytecode::cstore:
-    case Bytecode::new_array:
-      return 1;
-    default:
-      return 0;
-  }
-}
 #endif
 
 }  // namespace Linaro
\ No newline at end of file
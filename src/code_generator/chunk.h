@@ -40,7 +40,10 @@ class BytecodeChunk {
  public:
   BytecodeChunk() {}
   const std::vector<uint8_t>& code() { return m_code; }
-  const Location& getLocation(int i) { return *m_loc[i]; }
+  // Source location of the instruction at 'offset', line 0 if it has none.
+  Location getLocation(uint32_t offset) const;
+  // Source location of the instructions added from now on.
+  void setLocation(const Location& loc);
   inline uint8_t operator[](int i) const { return m_code[i]; }
   size_t chunkSize() const { return m_code.size(); }
   size_t currentOffset() const { return m_code.size() + 1; }
@@ -68,19 +71,44 @@ class BytecodeChunk {
     add16Bits((uint16_t)(arg >> 16));
   }
 
+  // Overwrites a 16 bit operand that has already been emitted.
+  inline void setByte(int i, uint8_t op) { m_code[i] = op; }
+  inline void set16Bits(int i, uint16_t arg) {
+    m_code[i] = (uint8_t)arg;
+    m_code[i + 1] = (uint8_t)(arg >> 8);
+  }
+
+  // Instruction layout. Every operand is 16 bits wide.
+  static int getNumArguments(Bytecode op);
+  static int instructionSize(Bytecode op) {
+    return 1 + 2 * getNumArguments(op);
+  }
+  // The first operand of a jump is its target.
+  static bool isJump(Bytecode op) {
+    return op == Bytecode::jmp || op == Bytecode::jmp_true ||
+           op == Bytecode::jmp_false || op == Bytecode::jmp_loop ||
+           op == Bytecode::for_prep || op == Bytecode::for_step;
+  }
+
 #ifdef DEBUG
   // Debug
   void disassembleChunk() const;
   static const char* bytecodeToString(Bytecode op);
   inline void disassembleBytecode(Bytecode op, unsigned* i) const;
-  int getNumArguments(Bytecode op) const;
 #endif
 
  private:
   std::vector<uint8_t> m_code;  // the code
   // Each bytecode is associated with a location in the source file.
-  // This is used for reporting potential errors at runtime.
-  std::vector<Location*> m_loc;
+  // This is used for reporting potential errors at runtime. Stored as runs,
+  // a location holds from its offset up to the offset of the next one.
+  struct LocationRun {
+    uint32_t offset;
+    const char* file;
+    int line;
+    int col;
+  };
+  std::vector<LocationRun> m_locations;
 };
 
 }  // namespace Linaro
@@ -1,32 +1,46 @@
 #include "code_generator.h"
 
-namespace Linaro {
+#include <algorithm>
+#include <cmath>
 
-#ifdef DEBUG
-std::vector<Function*> CodeGenerator::m_functions;
-#endif
+namespace Linaro {
 
-std::unique_ptr<Function> CodeGenerator::compile(FunctionLiteral* AST) {
+std::unique_ptr<Function> CodeGenerator::compile(
+    FunctionLiteral* AST, std::vector<Function*>& functions) {
   CHECK(AST != nullptr);
   auto top_level = std::make_unique<Function>(AST, AST->name(), AST->numArgs());
-  CodeGenerator cg;
+  CodeGenerator cg(&functions);
   cg.m_fn = top_level.get();
-
-#ifdef DEBUG
-  m_functions.push_back(top_level.get());
-#endif
+  cg.addFunction(top_level.get());
 
   cg.compileFunction(&cg, AST);
   top_level->setIsCompiled(true);
   cg.generateBytecode(Bytecode::halt);
+  // Fibers may assign globals between any two instructions of the others,
+  // what a function last stored in one tells nothing then.
+  bool fibers = std::any_of(functions.begin(), functions.end(),
+                            TypeAnalysis::mayRunFibers);
+  for (Function* fn : functions) TypeAnalysis::specialize(fn, !fibers);
   return top_level;
 }
 
+void CodeGenerator::addFunction(Function* fn) {
+  fn->setId(m_functions->size());
+  m_functions->push_back(fn);
+}
+
 void CodeGenerator::compileFunction(CodeGenerator* cg, FunctionLiteral* fn) {
   CHECK(cg != nullptr && fn != nullptr);
   // Create function scope (no param)
   cg->m_current_scope = std::make_unique<Scope>();
 
+  // The built-in functions are the first globals.
+  if (cg->m_enclosing_compiler == nullptr) {
+    for (int i = 0; i < Natives::count(); i++) {
+      cg->declareVariable(Natives::names[i], Location{"<builtin>", 0, 0});
+    }
+  }
+
   // Define parameters in function scope
   for (const auto& arg : fn->args()) {
     cg->declareVariable(arg.name(), arg.loc());
@@ -158,11 +172,13 @@ const Variable* CodeGenerator::resolveVariable(const std::string_view& name,
 /* --- Visit Expressions --- */
 
 void CodeGenerator::visitNullExpression(const NullExpression& ne) {
-  // If this is reached, an error has occured, so just return.
-  return;
+  // If this is reached, an error has occured. Stands in for the value, so
+  // that the operand stack stays balanced.
+  generateBytecode(Bytecode::null);
 }
 
 void CodeGenerator::visitLiteral(const Literal& val) {
+  setLocation(val.loc());
   Value v = val.value();
   if (v.isString() || v.isNumber()) {
     generateConstantIfNew(v);
@@ -180,17 +196,15 @@ void CodeGenerator::visitFunctionLiteral(const FunctionLiteral& node) {
   auto fn = std::make_shared<Function>(fn_literal, node.name(), node.numArgs());
 
   // TODO: For lazy compilation it shouldn't compile here.
-  CodeGenerator c(this);
+  CodeGenerator c(m_functions, this);
   c.m_fn = fn.get();
-
-#ifdef DEBUG
-  m_functions.push_back(fn.get());
-#endif
+  addFunction(fn.get());
 
   compileFunction(&c, fn_literal);
   fn->setIsCompiled(true);
 
   // Create closure
+  setLocation(node.loc());
   generateBytecode(Bytecode::closure, m_fn->addConstant(Value(fn)));
 
   // If it was a named function, it will have been forward declared in the
@@ -199,8 +213,9 @@ void CodeGenerator::visitFunctionLiteral(const FunctionLiteral& node) {
   if (node.isNamed()) {
     int i = m_current_scope->resolveSymbol(node.name());
     CHECK(i != -1);
-    generateBytecode(
-        fn_literal->isTopLevel() ? Bytecode::gstore : Bytecode::store, i);
+    m_last_store =
+        m_enclosing_compiler == nullptr ? Bytecode::gstore : Bytecode::store;
+    generateBytecode(m_last_store, i);
   }
   // Return null implicitly
   c.generateBytecode(Bytecode::null);
@@ -212,6 +227,7 @@ void CodeGenerator::visitArrayLiteral(const ArrayLiteral& node) {
   for (int i = node.size() - 1; i >= 0; i--) {
     elements[i]->visit(*this);
   }
+  setLocation(node.loc());
   generateBytecode(Bytecode::new_array, node.elements().size());
 }
 
@@ -224,7 +240,8 @@ void CodeGenerator::visitArrayAccess(const ArrayAccess& node) {
 void CodeGenerator::visitIdentifier(const Identifier& node) {
   const Variable* var = resolveVariable(node.name(), node.loc(), false);
   if (var == nullptr) return;
-  Bytecode op;
+  setLocation(node.loc());
+  Bytecode op = Bytecode::load;
   switch (var->origin()) {
     case VariableOrigin::top_level:
       op = Bytecode::gload;
@@ -293,6 +310,7 @@ void CodeGenerator::visitComparisonExpression(const BinaryOperation& node) {
   // todo: interpret x > y > z as x > y && y > z
   node.leftOperand()->visit(*this);
   node.rightOperand()->visit(*this);
+  setLocation(node.op().getLocation());
   switch (node.op().type()) {
     case TokenType::EQ:
       generateBytecode(Bytecode::eq);
@@ -320,6 +338,7 @@ void CodeGenerator::visitComparisonExpression(const BinaryOperation& node) {
 void CodeGenerator::visitArithmeticExpression(const BinaryOperation& node) {
   node.leftOperand()->visit(*this);
   node.rightOperand()->visit(*this);
+  setLocation(node.op().getLocation());
   switch (node.op().type()) {
     case TokenType::ADD:
       generateBytecode(Bytecode::add);
@@ -348,6 +367,7 @@ void CodeGenerator::visitUnaryOperation(const UnaryOperation& node) {
   auto operand = node.operand();
   auto op = node.op();
   operand->visit(*this);
+  setLocation(op.getLocation());
   switch (op.type()) {
     case TokenType::SUB:
       generateBytecode(Bytecode::neg);
@@ -394,11 +414,12 @@ void CodeGenerator::visitAssignment(const Assignment& node) {
 
 void CodeGenerator::visitAssignmentTarget(Expression* target,
                                           const Location& loc) {
+  setLocation(loc);
   if (target->isIdentifier()) {
     Identifier* id = target->asIdentifier();
     const Variable* var = resolveVariable(id->name(), id->loc(), true);
     int index;
-    Bytecode op;
+    Bytecode op = Bytecode::store;
     if (var == nullptr) {
       // Variable was not defined, so define it at use:
       index = m_current_scope->defineSymbol(id->name());
@@ -420,12 +441,17 @@ void CodeGenerator::visitAssignmentTarget(Expression* target,
           break;
       }
     }
+    if (op != Bytecode::store) noteSharedWrite();
     generateBytecode(op, index);
+    m_last_store = op;
   } else if (target->isArrayAccess()) {
+    noteSharedWrite();
     ArrayAccess* ac = target->asArrayAccess();
     ac->target()->visit(*this);
     ac->index()->visit(*this);
+    setLocation(loc);
     generateBytecode(Bytecode::astore);
+    m_last_store = Bytecode::astore;
   } else {
     semanticError(loc, "Left hand side of assignment invalid");
     return;
@@ -433,6 +459,9 @@ void CodeGenerator::visitAssignmentTarget(Expression* target,
 }
 
 void CodeGenerator::visitCall(const Call& node) {
+  // Callees are late bound and every built-in has effects, so nothing a
+  // call does is known here.
+  noteSharedWrite();
   // Visit arguments and put them on stack before call.
   const auto& args = node.arguments();
   // Consider visiting them in the reverse order?
@@ -441,7 +470,17 @@ void CodeGenerator::visitCall(const Call& node) {
     args[i]->visit(*this);
   }
   node.caller()->visit(*this);
-  generateBytecode(call_tos, arity);
+  switch (node.type()) {
+    case CallType::normal:
+      generateBytecode(call_tos, arity);
+      break;
+    case CallType::spawn:
+      generateBytecode(Bytecode::spawn, arity);
+      break;
+    case CallType::join:
+      generateBytecode(Bytecode::join, arity);
+      break;
+  }
 }
 
 /* ---  statements --- */
@@ -459,7 +498,22 @@ void CodeGenerator::visitBlock(const Block& blk) {
 }
 
 void CodeGenerator::visitExpressionStatement(const ExpressionStatement& stmt) {
-  stmt.expr()->visit(*this);
+  Expression* expr = stmt.expr();
+  expr->visit(*this);
+  // Drop the value of the statement, so it doesn't pile up on the operand
+  // stack. Stores, including the one of a named function, consume the value
+  // they store, except for gstore. ++ and -- leave a copy of the old or new
+  // value on top of that.
+  int values = 1;
+  if (expr->isAssignment() ||
+      (expr->isFunctionLiteral() && expr->asFunctionLiteral()->isNamed())) {
+    values = m_last_store == Bytecode::gstore ? 1 : 0;
+  } else if (expr->isUnaryOperation()) {
+    TokenType op = expr->asUnaryOperation()->op().type();
+    if (op == TokenType::INCR || op == TokenType::DECR)
+      values = m_last_store == Bytecode::gstore ? 2 : 1;
+  }
+  for (int i = 0; i < values; i++) generateBytecode(Bytecode::pop);
 }
 
 void CodeGenerator::visitFunctionDeclaration(const FunctionDeclaration& node) {
@@ -478,15 +532,12 @@ void CodeGenerator::visitPrintStatement(const PrintStatement& node) {
 
 void CodeGenerator::visitIfStatement(const IfStatement& node) {
   if (node.expr()->toBooleanIsTrue()) {
-    std::cout << "RAHCED1" << std::endl;
     node.ifBlock()->visit(*this);
   } else if (node.expr()->toBooleanIsFalse()) {
     if (node.hasElseBlock()) {
-      std::cout << "RAHCED2" << std::endl;
       node.elseBlock()->visit(*this);
     }
   } else {
-    std::cout << "RAHCED3" << std::endl;
     // Visit condition.
     node.expr()->visit(*this);
     Label else_label(code()->currentOffset());
@@ -502,8 +553,12 @@ void CodeGenerator::visitIfStatement(const IfStatement& node) {
       node.elseBlock()->visit(*this);
       code()->patchJump(end_label);
     } else {
+      // The condition has already been popped if the if block ran.
+      Label end_label(code()->currentOffset());
+      generateBytecode(Bytecode::jmp, 0);
       code()->patchJump(else_label);
       generateBytecode(Bytecode::pop);
+      code()->patchJump(end_label);
     }
   }
 }
@@ -514,9 +569,127 @@ void CodeGenerator::visitWhileStatement(const WhileStatement& node) {
   Label end(code()->currentOffset());
   generateBytecode(Bytecode::jmp_false, 0);
   node.whileBlock()->visit(*this);
-  generateBytecode(Bytecode::jmp, start_of_block);
+  generateBytecode(Bytecode::jmp_loop, start_of_block, m_fn->addLoop());
   code()->patchJump(end);
   generateBytecode(Bytecode::pop);
 }
 
-}  // namespace Linaro
\ No newline at end of file
+void CodeGenerator::visitForStatement(const ForStatement& node) {
+  if (node.isParallel()) {
+    const auto& reductions = node.reductions();
+    if (reductions.size() > (size_t)MAX_REDUCTIONS) {
+      semanticError(node.variable().getLocation(),
+                    "A parallel for loop can't have more than %d reductions",
+                    MAX_REDUCTIONS);
+      return;
+    }
+    std::shared_ptr<Function> body = compileParallelBody(node);
+    if (body != nullptr) {
+      // The reduction variables start out with their current values.
+      uint16_t ops = 0;
+      for (size_t i = 0; i < reductions.size(); i++) {
+        Identifier(reductions[i].variable).visit(*this);
+        ops |= (uint16_t)reductions[i].op << (2 * i);
+      }
+      generateBytecode(Bytecode::closure, m_fn->addConstant(Value(body)));
+      visitExpressionForValue(node.start());
+      visitExpressionForValue(node.end());
+      generateBytecode(Bytecode::parallel_for, reductions.size(), ops);
+      for (int i = reductions.size() - 1; i >= 0; i--) {
+        Identifier variable(reductions[i].variable);
+        visitAssignmentTarget(&variable, variable.loc());
+        // gstore leaves the value on the stack.
+        if (m_last_store == Bytecode::gstore) generateBytecode(Bytecode::pop);
+      }
+      return;
+    }
+  }
+  visitExpressionForValue(node.start());
+  visitExpressionForValue(node.end());
+  emitForLoop(node);
+}
+
+void CodeGenerator::emitForLoop(const ForStatement& node) {
+  int counter = m_current_scope->defineTemporaries(2);
+  Label exit(code()->currentOffset());
+  generateBytecode(Bytecode::for_prep, 0, counter);
+  int header = code()->currentOffset() - 1;
+  generateBytecode(Bytecode::load, counter);
+  Identifier variable(node.variable());
+  visitAssignmentTarget(&variable, variable.loc());
+  if (m_last_store == Bytecode::gstore) generateBytecode(Bytecode::pop);
+  node.block()->visit(*this);
+  generateBytecode(Bytecode::for_step, header, counter);
+  emit16Bits(m_fn->addLoop());
+  code()->patchJump(exit);
+}
+
+std::shared_ptr<Function> CodeGenerator::compileParallelBody(
+    const ForStatement& node) {
+  auto fn = std::make_shared<Function>(nullptr, "parallel for", 2);
+  CodeGenerator c(m_functions, this);
+  c.m_fn = fn.get();
+  c.m_is_parallel_body = true;
+  int first_id = m_functions->size();
+  addFunction(fn.get());
+
+  c.m_current_scope = std::make_unique<Scope>();
+  int bounds = c.m_current_scope->defineTemporaries(2);
+  // The loop variable and the reduction variables are private to a chunk of
+  // the range. The reductions start out with the identity of their operator.
+  const Token& variable = node.variable();
+  c.declareVariable(variable.asString(), variable.getLocation());
+  std::vector<int> reductions;
+  for (const Reduction& r : node.reductions()) {
+    c.declareVariable(r.variable.asString(), r.variable.getLocation());
+    int index = c.m_current_scope->resolveSymbol(r.variable.asString());
+    reductions.push_back(index);
+    double identity = 0;
+    switch (r.op) {
+      case ReductionOp::add:
+        identity = 0;
+        break;
+      case ReductionOp::mul:
+        identity = 1;
+        break;
+      case ReductionOp::min:
+        identity = INFINITY;
+        break;
+      case ReductionOp::max:
+        identity = -INFINITY;
+        break;
+    }
+    c.generateConstantIfNew(Value(identity));
+    c.generateBytecode(Bytecode::store, index);
+  }
+
+  c.generateBytecode(Bytecode::load, bounds);
+  c.generateBytecode(Bytecode::load, bounds + 1);
+  c.emitForLoop(node);
+  for (int i = reductions.size() - 1; i >= 0; i--) {
+    c.generateBytecode(Bytecode::load, reductions[i]);
+  }
+  c.generateBytecode(Bytecode::new_array, reductions.size());
+  c.generateBytecode(Bytecode::ret);
+  fn->setNumLocals(c.m_current_scope->index());
+
+  if (c.m_writes_shared_state) {
+    // Forget the function and the functions nested in it.
+    m_functions->resize(first_id);
+    return nullptr;
+  }
+  fn->setIsCompiled(true);
+  return fn;
+}
+
+void CodeGenerator::noteSharedWrite() {
+  for (CodeGenerator* cg = this; cg != nullptr;
+       cg = cg->m_enclosing_compiler) {
+    if (cg->m_is_parallel_body) {
+      cg->m_writes_shared_state = true;
+      return;
+    }
+  }
+}
+
+}  // namespace Linaro
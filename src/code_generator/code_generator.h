@@ -7,9 +7,11 @@
 #include "../ast/ast.h"
 #include "../linaro_utils/utils.h"
 #include "../parsing/parser.h"
+#include "../vm/natives.h"
 #include "../vm/objects.h"
 #include "chunk.h"
 #include "scope.h"
+#include "type_analysis.h"
 
 namespace Linaro {
 
@@ -50,15 +52,18 @@ class CodeGenerator : public NodeVisitor {
   // Because it's the top-level function, it will not exist in
   // some constant pool. The caller is therefor responsible for
   // the created function.
-  static std::unique_ptr<Function> compile(FunctionLiteral* AST);
-
-#ifdef DEBUG
-  static const auto& getFunctions() { return m_functions; }
-#endif
+  // Every function compiled is appended to 'functions', at the index that
+  // is its id.
+  static std::unique_ptr<Function> compile(FunctionLiteral* AST,
+                                           std::vector<Function*>& functions);
 
  private:
-  CodeGenerator(CodeGenerator* enclosing_compiler = nullptr)
-      : m_enclosing_compiler{enclosing_compiler} {}
+  CodeGenerator(std::vector<Function*>* functions,
+                CodeGenerator* enclosing_compiler = nullptr)
+      : m_enclosing_compiler{enclosing_compiler}, m_functions{functions} {}
+
+  // Gives 'fn' the next id.
+  void addFunction(Function* fn);
   ~CodeGenerator() {}
   // During visitation of a FunctionLiteral, a Function object is added to
   // parent constant pool (which stores the AST of the function). When the
@@ -73,6 +78,9 @@ class CodeGenerator : public NodeVisitor {
   // Gets chunk of function being compiled.
   inline BytecodeChunk* code() { return m_fn->code(); }
 
+  // The bytecodes emitted from now on come from 'loc'.
+  inline void setLocation(const Location& loc) { code()->setLocation(loc); }
+
   // Emitting raw data to current chunk
   inline void emitByte(uint8_t byte);
   inline void emit16Bits(uint16_t op);
@@ -115,6 +123,18 @@ class CodeGenerator : public NodeVisitor {
   void visitExpressionForValue(Expression* expr);
   void visitLocalScope(Block* blk);
   void visitAssignmentTarget(Expression* target, const Location& loc);
+
+  // Emits the loop of a for statement, with the bounds of its range on top
+  // of the operand stack.
+  void emitForLoop(const ForStatement& node);
+  // Compiles the body of a parallel for loop into a function that runs the
+  // loop over [lo, hi) and returns an array with the values of the reduction
+  // variables. Returns nullptr if the body assigns variables it doesn't own
+  // or array elements, or calls anything, the loop is run sequentially then.
+  std::shared_ptr<Function> compileParallelBody(const ForStatement& node);
+  // Called for assignments to anything but the function's own locals, and
+  // for calls.
+  void noteSharedWrite();
   // Visitation methods custom for this class:
 
   // Visit binary op will dispatch to one of these:
@@ -140,10 +160,15 @@ class CodeGenerator : public NodeVisitor {
   // Hash set of variables
   std::unordered_set<Variable, Variable::VariableHasher> m_variables;
 
-#ifdef DEBUG
-  // All functions in the script (only needed for debug information)
-  static std::vector<Function*> m_functions;
-#endif
+  // All functions in the script, indexed by their id.
+  std::vector<Function*>* m_functions;
+
+  // Set for the body of a parallel for loop, see compileParallelBody().
+  bool m_is_parallel_body = false;
+  bool m_writes_shared_state = false;
+
+  // What the last assignment was compiled to, see visitAssignmentTarget().
+  Bytecode m_last_store = Bytecode::store;
 };
 
 }  // namespace Linaro
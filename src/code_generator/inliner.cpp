@@ -0,0 +1,273 @@
+#include "inliner.h"
+
+#include <algorithm>
+
+#include "../vm/program.h"
+
+namespace Linaro {
+
+Inliner::Inliner(Isolate& isolate, Function* fn)
+    : m_isolate{isolate},
+      m_fn{fn},
+      m_optimized{std::make_shared<OptimizedCode>()} {
+  m_optimized->num_locals = fn->numLocals();
+  m_optimized->constants = fn->constants();
+}
+
+bool Inliner::canInline(Isolate& isolate, const Function* caller,
+                        Function* callee) {
+  std::vector<const Function*> chain{caller};
+  return canInline(isolate, chain, callee);
+}
+
+bool Inliner::canInline(Isolate& isolate, std::vector<const Function*>& chain,
+                        Function* callee) {
+  if (callee == nullptr || callee->numCapturedVariables() > 0) return false;
+  if (std::find(chain.begin(), chain.end(), callee) != chain.end())
+    return false;
+
+  BytecodeChunk* code = callee->code();
+  if (code->chunkSize() > MAX_INLINE_BYTECODE_SIZE) return false;
+
+  for (uint32_t i = 0; i < code->chunkSize();) {
+    Bytecode op = static_cast<Bytecode>(code->readByte(i));
+    switch (op) {
+      case Bytecode::nop:
+      case Bytecode::pop:
+      case Bytecode::dup:
+      case Bytecode::incr:
+      case Bytecode::decr:
+      case Bytecode::add:
+      case Bytecode::sub:
+      case Bytecode::mod:
+      case Bytecode::mul:
+      case Bytecode::div:
+      case Bytecode::exp:
+      case Bytecode::neg:
+      case Bytecode::incr_num:
+      case Bytecode::decr_num:
+      case Bytecode::add_num:
+      case Bytecode::sub_num:
+      case Bytecode::mod_num:
+      case Bytecode::mul_num:
+      case Bytecode::div_num:
+      case Bytecode::neg_num:
+      case Bytecode::lt_num:
+      case Bytecode::lte_num:
+      case Bytecode::gt_num:
+      case Bytecode::gte_num:
+      case Bytecode::neq:
+      case Bytecode::eq:
+      case Bytecode::lt:
+      case Bytecode::lte:
+      case Bytecode::gt:
+      case Bytecode::gte:
+      case Bytecode::NOT:
+      case Bytecode::to_bool:
+      case Bytecode::jmp:
+      case Bytecode::jmp_true:
+      case Bytecode::jmp_false:
+      case Bytecode::jmp_loop:
+      case Bytecode::constant:
+      case Bytecode::new_array:
+      case Bytecode::TRUE:
+      case Bytecode::FALSE:
+      case Bytecode::null:
+      case Bytecode::gload:
+      case Bytecode::gstore:
+      case Bytecode::load:
+      case Bytecode::store:
+      case Bytecode::aload:
+      case Bytecode::astore:
+      case Bytecode::print:
+      case Bytecode::ret:
+        break;
+      case Bytecode::call_tos: {
+        // Only calls that can be inlined into the callee in turn.
+        if (chain.size() >= MAX_INLINE_DEPTH) return false;
+        CallSiteFeedback* feedback =
+            isolate.profile(callee).getCallSiteFeedback(i);
+        if (feedback == nullptr || feedback->is_polymorphic ||
+            feedback->count < INLINE_CALL_THRESHOLD)
+          return false;
+        chain.push_back(callee);
+        bool can_inline = canInline(isolate, chain, feedback->callee);
+        chain.pop_back();
+        if (!can_inline) return false;
+        break;
+      }
+      default:
+        // Closures and captured variables would need a frame of their own.
+        return false;
+    }
+    i += BytecodeChunk::instructionSize(op);
+  }
+  return true;
+}
+
+std::shared_ptr<OptimizedCode> Inliner::optimize(Isolate& isolate,
+                                                 Function* fn) {
+  CHECK(fn != nullptr);
+  Inliner inliner(isolate, fn);
+  BytecodeChunk* baseline = fn->code();
+  BytecodeChunk& code = inliner.m_optimized->code;
+
+  // Maps offsets in the baseline code to offsets in the optimized code.
+  std::unordered_map<uint32_t, uint32_t> offsets;
+  std::vector<uint32_t> jumps;
+  std::vector<InlinedFrameState> frames;
+  for (uint32_t i = 0; i < baseline->chunkSize();) {
+    Bytecode op = static_cast<Bytecode>(baseline->readByte(i));
+    offsets[i] = code.chunkSize();
+    code.setLocation(baseline->getLocation(i));
+    Function* callee = nullptr;
+    if (op == Bytecode::call_tos)
+      callee = inliner.inlineCandidate(fn, i, frames);
+
+    if (callee != nullptr)
+      inliner.inlineCall(i, callee, frames);
+    else
+      inliner.copyInstruction(baseline, i, jumps);
+
+    // Loops are entered backwards, so the header has been copied already.
+    if (op == Bytecode::jmp_loop || op == Bytecode::for_step) {
+      uint32_t header = baseline->read16Bits(i + 1);
+      inliner.m_optimized->osr_entries[header] = offsets.at(header);
+    }
+    i += BytecodeChunk::instructionSize(op);
+  }
+  offsets[baseline->chunkSize()] = code.chunkSize();
+  inliner.relocateJumps(jumps, offsets);
+
+  // Jump targets are 16 bits.
+  if (inliner.m_optimized->inlined_calls.empty() ||
+      code.chunkSize() > UINT16_MAX)
+    return nullptr;
+  return inliner.m_optimized;
+}
+
+Function* Inliner::inlineCandidate(
+    Function* caller, uint32_t offset,
+    const std::vector<InlinedFrameState>& frames) {
+  CallSiteFeedback* feedback =
+      m_isolate.profile(caller).getCallSiteFeedback(offset);
+  if (feedback == nullptr || feedback->is_polymorphic ||
+      feedback->count < INLINE_CALL_THRESHOLD)
+    return nullptr;
+
+  std::vector<const Function*> chain{m_fn};
+  for (const auto& frame : frames) chain.push_back(frame.fn);
+  Function* callee = feedback->callee;
+  // The inlined body binds exactly the arguments the callee takes.
+  if (caller->code()->read16Bits(offset + 1) != callee->numArgs())
+    return nullptr;
+  if (!canInline(m_isolate, chain, callee)) return nullptr;
+  // The callee's locals and its closure.
+  if (m_optimized->num_locals + callee->numLocals() + 1 > UINT16_MAX)
+    return nullptr;
+  return callee;
+}
+
+void Inliner::copyInstruction(BytecodeChunk* from, uint32_t offset,
+                              std::vector<uint32_t>& jumps) {
+  BytecodeChunk& code = m_optimized->code;
+  Bytecode op = static_cast<Bytecode>(from->readByte(offset));
+  code.addByte(op);
+  if (BytecodeChunk::isJump(op)) jumps.push_back(code.chunkSize());
+  for (int i = 0; i < BytecodeChunk::getNumArguments(op); i++) {
+    code.add16Bits(from->read16Bits(offset + 1 + 2 * i));
+  }
+}
+
+void Inliner::inlineCall(uint32_t offset, Function* callee,
+                         std::vector<InlinedFrameState>& frames) {
+  BytecodeChunk& code = m_optimized->code;
+  uint16_t base = m_optimized->num_locals;
+  uint16_t closure_slot = base + callee->numLocals();
+  m_optimized->num_locals += callee->numLocals() + 1;
+
+  // The guard checks that the closure on top of the stack is still an
+  // instance of 'callee'. If so, it binds the arguments and falls through to
+  // the body. Otherwise the frame state is used to continue at the call_tos
+  // in the baseline code.
+  m_optimized->frame_states[code.chunkSize()] = {offset, frames};
+  m_optimized->inlined_calls.push_back({callee, base, closure_slot});
+  code.addByte(Bytecode::invoke_inline);
+  code.add16Bits(m_optimized->inlined_calls.size() - 1);
+
+  BytecodeChunk* body = callee->code();
+  std::unordered_map<uint32_t, uint32_t> offsets;
+  std::vector<uint32_t> jumps;
+  std::vector<uint32_t> returns;
+  frames.push_back({callee, base, closure_slot, offset + 3});
+  for (uint32_t i = 0; i < body->chunkSize();) {
+    Bytecode op = static_cast<Bytecode>(body->readByte(i));
+    offsets[i] = code.chunkSize();
+    code.setLocation(body->getLocation(i));
+    Function* nested = nullptr;
+    if (op == Bytecode::call_tos) nested = inlineCandidate(callee, i, frames);
+
+    switch (op) {
+      case Bytecode::ret:
+        // Returning leaves the return value on the operand stack, just
+        // like a real call does.
+        code.addByte(Bytecode::jmp);
+        returns.push_back(code.chunkSize());
+        code.add16Bits(0);
+        break;
+      case Bytecode::load:
+      case Bytecode::store:
+        code.addByte(op);
+        code.add16Bits(base + body->read16Bits(i + 1));
+        break;
+      case Bytecode::constant:
+        code.addByte(op);
+        code.add16Bits(
+            addConstant(callee->getConstant(body->read16Bits(i + 1))));
+        break;
+      case Bytecode::call_tos:
+        // canInline() made sure the callee can be inlined as well, unless
+        // the local space ran out. A generic call works from inlined code
+        // too.
+        if (nested != nullptr) {
+          inlineCall(i, nested, frames);
+          break;
+        }
+        copyInstruction(body, i, jumps);
+        break;
+      default:
+        copyInstruction(body, i, jumps);
+    }
+    i += BytecodeChunk::instructionSize(op);
+  }
+  frames.pop_back();
+  offsets[body->chunkSize()] = code.chunkSize();
+  relocateJumps(jumps, offsets);
+
+  uint32_t end = code.chunkSize();
+  for (uint32_t r : returns) code.set16Bits(r, end);
+}
+
+int Inliner::addConstant(const Value& val) {
+  auto& constants = m_optimized->constants;
+  for (size_t i = 0; i < constants.size(); i++) {
+    const Value& c = constants[i];
+    if (val.isNumber() && c.isNumber() && Value::equal(val, c)) return i;
+    if (val.isString() && c.isString() && Value::equal(val, c)) return i;
+  }
+  constants.push_back(val);
+  return constants.size() - 1;
+}
+
+void Inliner::relocateJumps(
+    const std::vector<uint32_t>& jumps,
+    const std::unordered_map<uint32_t, uint32_t>& offsets) {
+  BytecodeChunk& code = m_optimized->code;
+  for (uint32_t j : jumps) {
+    auto it = offsets.find(code.read16Bits(j));
+    CHECK(it != offsets.end());
+    if (it != offsets.end()) code.set16Bits(j, it->second);
+  }
+}
+
+}  // namespace Linaro
@@ -0,0 +1,94 @@
+#ifndef INLINER_H
+#define INLINER_H
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "../vm/deoptimizer.h"
+#include "../vm/objects.h"
+#include "chunk.h"
+
+namespace Linaro {
+
+struct Isolate;  // See program.h
+
+// A call site in optimized code where the body of the callee has been
+// spliced into the caller.
+struct InlinedCall {
+  // The function the call site was specialized for.
+  Function* callee;
+  // First slot in the caller's local space holding the callee's locals.
+  uint16_t local_base;
+  // Slot the closure is kept in while the inlined body runs.
+  uint16_t closure_slot;
+};
+
+// Optimized version of a function's bytecode.
+struct OptimizedCode {
+  BytecodeChunk code;
+  // The constant pool of the function, followed by the constants of the
+  // inlined callees. The function itself is shared by every isolate, so it
+  // isn't touched.
+  std::vector<Value> constants;
+  // Locals of the function plus the locals of every inlined callee.
+  int num_locals;
+  std::vector<InlinedCall> inlined_calls;
+  // Frame states of the guards, keyed by their offset in 'code'.
+  std::unordered_map<uint32_t, FrameState> frame_states;
+  // Where a frame running a loop in the baseline code continues in 'code',
+  // keyed by the offset of the loop header in the baseline code.
+  std::unordered_map<uint32_t, uint32_t> osr_entries;
+};
+
+class Inliner {
+ public:
+  // Returns true if 'callee' is small and neither captures nor creates
+  // closures. Calls made by 'callee' must themselves be inlinable, at most
+  // MAX_INLINE_DEPTH levels deep and never back into a function that is
+  // already being inlined. Call site feedback is taken from 'isolate'.
+  static bool canInline(Isolate& isolate, const Function* caller,
+                        Function* callee);
+
+  // Creates optimized code for 'fn' where every hot monomorphic call site
+  // with an inlinable callee has been replaced by the body of the callee.
+  // Returns nullptr if no call site could be inlined.
+  static std::shared_ptr<OptimizedCode> optimize(Isolate& isolate,
+                                                 Function* fn);
+
+ private:
+  Inliner(Isolate& isolate, Function* fn);
+
+  static bool canInline(Isolate& isolate, std::vector<const Function*>& chain,
+                        Function* callee);
+
+  // Returns the callee of the call_tos at 'offset' in 'caller' if it should
+  // be inlined. 'frames' are the inlined frames 'caller' is nested in.
+  Function* inlineCandidate(Function* caller, uint32_t offset,
+                            const std::vector<InlinedFrameState>& frames);
+
+  // Copies a single instruction from 'from' to the optimized code. Jump
+  // targets are remembered so they can be relocated once all offsets are
+  // known.
+  void copyInstruction(BytecodeChunk* from, uint32_t offset,
+                       std::vector<uint32_t>& jumps);
+
+  // Emits the guard and the body of 'callee' in place of the call_tos at
+  // 'offset'. 'frames' are the inlined frames the call site is nested in.
+  void inlineCall(uint32_t offset, Function* callee,
+                  std::vector<InlinedFrameState>& frames);
+
+  // Adds a constant of the callee to the constant pool of the caller.
+  int addConstant(const Value& val);
+
+  void relocateJumps(const std::vector<uint32_t>& jumps,
+                     const std::unordered_map<uint32_t, uint32_t>& offsets);
+
+  Isolate& m_isolate;
+  Function* m_fn;
+  std::shared_ptr<OptimizedCode> m_optimized;
+};
+
+}  // namespace Linaro
+
+#endif  // INLINER_H
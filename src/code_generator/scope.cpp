@@ -14,6 +14,12 @@ int Scope::defineSymbol(const std::string_view& name) {
   return -1;
 }
 
+int Scope::defineTemporaries(int n) {
+  m_num_locals += n;
+  m_index += n;
+  return m_index - n;
+}
+
 int Scope::resolveSymbol(const std::string_view& name) {
   auto it = m_symbol_table.find(name);
   if (it != m_symbol_table.end()) {
@@ -2,6 +2,7 @@
 #define SCOPE_H
 
 #include <memory>
+#include <string_view>
 #include <unordered_map>
 
 namespace Linaro {
@@ -16,6 +17,9 @@ class Scope {
   // Returns index of the symbol. -1 if not found.
   int defineSymbol(const std::string_view& name);
   int resolveSymbol(const std::string_view& name);
+  // Defines 'n' consecutive locals without a name, for the compiler's own
+  // use. Returns the index of the first.
+  int defineTemporaries(int n);
   int numLocals() const { return m_num_locals; }
   int index() const { return m_index; }
   void addToIndex(int n) { m_index += n; }
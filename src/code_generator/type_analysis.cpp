@@ -0,0 +1,347 @@
+#include "type_analysis.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "../vm/natives.h"
+
+namespace Linaro {
+
+void TypeAnalysis::specialize(Function* fn, bool track_globals) {
+  CHECK(fn != nullptr);
+  TypeAnalysis analysis(fn, track_globals);
+  analysis.run();
+  analysis.rewrite();
+}
+
+bool TypeAnalysis::mayRunFibers(Function* fn) {
+  CHECK(fn != nullptr);
+  const BytecodeChunk* code = fn->code();
+  for (uint32_t i = 0; i < code->chunkSize();) {
+    Bytecode op = static_cast<Bytecode>(code->readByte(i));
+    if (op == Bytecode::spawn || op == Bytecode::parallel_for) return true;
+    // Built-ins are the first globals, loading one is the only way to call
+    // it, even under another name.
+    if (op == Bytecode::gload && code->read16Bits(i + 1) < Natives::count()) {
+      const char* name = Natives::names[code->read16Bits(i + 1)];
+      if (strcmp(name, "pmap") == 0 || strcmp(name, "preduce") == 0 ||
+          strcmp(name, "pfilter") == 0 || strcmp(name, "then") == 0)
+        return true;
+    }
+    i += BytecodeChunk::instructionSize(op);
+  }
+  return false;
+}
+
+TypeAnalysis::TypeAnalysis(Function* fn, bool track_globals)
+    : m_fn{fn},
+      m_code{fn->code()},
+      m_track_globals{track_globals},
+      m_states(fn->code()->chunkSize() + 1) {
+  for (uint32_t i = 0; i < m_code->chunkSize();) {
+    Bytecode op = static_cast<Bytecode>(m_code->readByte(i));
+    if (op == Bytecode::closure) {
+      Function& inner = fn->getConstant(m_code->read16Bits(i + 1))
+                            .valueTo<Function>();
+      for (const auto& captured : inner.getCapturedVariables()) {
+        if (captured.is_local) m_captured_locals.insert(captured.index);
+      }
+    }
+    i += BytecodeChunk::instructionSize(op);
+  }
+}
+
+void TypeAnalysis::run() {
+  // Arguments can be anything, and so can locals that haven't been assigned
+  // yet (they're undefined).
+  State entry;
+  entry.locals.assign(m_fn->numLocals(), StaticType::any);
+  propagate(0, entry);
+  while (!m_worklist.empty()) {
+    uint32_t offset = m_worklist.back();
+    m_worklist.pop_back();
+    transfer(offset, m_states[offset]);
+  }
+}
+
+void TypeAnalysis::rewrite() {
+  for (uint32_t i = 0; i < m_code->chunkSize();) {
+    Bytecode op = static_cast<Bytecode>(m_code->readByte(i));
+    const State& state = m_states[i];
+    bool numbers = peek(state) == StaticType::number &&
+                   peek(state, 1) == StaticType::number;
+    Bytecode specialized = op;
+    if (state.reached) {
+      switch (op) {
+        case Bytecode::add:
+          if (numbers) specialized = Bytecode::add_num;
+          break;
+        case Bytecode::sub:
+          if (numbers) specialized = Bytecode::sub_num;
+          break;
+        case Bytecode::mod:
+          if (numbers) specialized = Bytecode::mod_num;
+          break;
+        case Bytecode::mul:
+          if (numbers) specialized = Bytecode::mul_num;
+          break;
+        case Bytecode::div:
+          if (numbers) specialized = Bytecode::div_num;
+          break;
+        case Bytecode::lt:
+          if (numbers) specialized = Bytecode::lt_num;
+          break;
+        case Bytecode::lte:
+          if (numbers) specialized = Bytecode::lte_num;
+          break;
+        case Bytecode::gt:
+          if (numbers) specialized = Bytecode::gt_num;
+          break;
+        case Bytecode::gte:
+          if (numbers) specialized = Bytecode::gte_num;
+          break;
+        case Bytecode::incr:
+          if (peek(state) == StaticType::number)
+            specialized = Bytecode::incr_num;
+          break;
+        case Bytecode::decr:
+          if (peek(state) == StaticType::number)
+            specialized = Bytecode::decr_num;
+          break;
+        case Bytecode::neg:
+          if (peek(state) == StaticType::number)
+            specialized = Bytecode::neg_num;
+          break;
+        case Bytecode::to_bool:
+          if (peek(state) == StaticType::boolean) specialized = Bytecode::nop;
+          break;
+        default:
+          break;
+      }
+    }
+    m_code->setByte(i, specialized);
+    i += BytecodeChunk::instructionSize(op);
+  }
+}
+
+void TypeAnalysis::transfer(uint32_t offset, State state) {
+  Bytecode op = static_cast<Bytecode>(m_code->readByte(offset));
+  uint32_t next = offset + BytecodeChunk::instructionSize(op);
+  uint16_t operand = 0;
+  if (BytecodeChunk::getNumArguments(op) > 0)
+    operand = m_code->read16Bits(offset + 1);
+
+  switch (op) {
+    case Bytecode::nop:
+      break;
+    case Bytecode::pop:
+    case Bytecode::print:
+    case Bytecode::cstore:
+      pop(state);
+      break;
+    case Bytecode::dup:
+      state.stack.push_back(peek(state));
+      break;
+    case Bytecode::incr:
+    case Bytecode::decr: {
+      // incr concatenates strings, and both give undefined for null.
+      StaticType t = pop(state);
+      state.stack.push_back(t == StaticType::number ? t : StaticType::any);
+      break;
+    }
+    case Bytecode::add:
+    case Bytecode::sub:
+    case Bytecode::mod:
+    case Bytecode::mul:
+    case Bytecode::div:
+    case Bytecode::exp: {
+      StaticType rhs = pop(state);
+      StaticType lhs = pop(state);
+      state.stack.push_back(
+          lhs == StaticType::number && rhs == StaticType::number
+              ? StaticType::number
+              : StaticType::any);
+      break;
+    }
+    case Bytecode::neg:
+      pop(state);
+      state.stack.push_back(StaticType::number);
+      break;
+    case Bytecode::neq:
+    case Bytecode::eq:
+    case Bytecode::lt:
+    case Bytecode::lte:
+    case Bytecode::gt:
+    case Bytecode::gte:
+      pop(state);
+      pop(state);
+      state.stack.push_back(StaticType::boolean);
+      break;
+    case Bytecode::NOT:
+    case Bytecode::to_bool:
+      pop(state);
+      state.stack.push_back(StaticType::boolean);
+      break;
+    case Bytecode::jmp:
+    case Bytecode::jmp_loop:
+      propagate(operand, state);
+      return;
+    case Bytecode::jmp_true:
+    case Bytecode::jmp_false:
+      // Jumping keeps the condition on the stack, falling through pops it.
+      propagate(operand, state);
+      pop(state);
+      break;
+    case Bytecode::for_prep: {
+      // Both bounds are checked to be numbers.
+      pop(state);
+      pop(state);
+      uint16_t counter = m_code->read16Bits(offset + 3);
+      state.locals[counter] = StaticType::number;
+      state.locals[counter + 1] = StaticType::number;
+      propagate(operand, state);
+      break;
+    }
+    case Bytecode::for_step:
+      propagate(operand, state);
+      break;
+    case Bytecode::parallel_for:
+      // The reduction variables, the body, and the bounds of the range.
+      for (int i = 0; i < operand + 3; i++) pop(state);
+      for (int i = 0; i < operand; i++) state.stack.push_back(StaticType::any);
+      state.globals.clear();
+      break;
+    case Bytecode::constant:
+      state.stack.push_back(constantType(m_fn->getConstant(operand)));
+      break;
+    case Bytecode::TRUE:
+    case Bytecode::FALSE:
+      state.stack.push_back(StaticType::boolean);
+      break;
+    case Bytecode::new_obj:
+    case Bytecode::null:
+    case Bytecode::cload:
+    case Bytecode::closure:
+      state.stack.push_back(StaticType::any);
+      break;
+    case Bytecode::new_array:
+      for (int i = 0; i < operand; i++) pop(state);
+      state.stack.push_back(StaticType::any);
+      break;
+    case Bytecode::gload:
+      state.stack.push_back(operand < state.globals.size()
+                                ? state.globals[operand]
+                                : StaticType::any);
+      break;
+    case Bytecode::gstore:
+      if (!m_track_globals) break;
+      if (operand >= state.globals.size())
+        state.globals.resize(operand + 1, StaticType::any);
+      state.globals[operand] = peek(state);
+      break;
+    case Bytecode::load:
+      state.stack.push_back(m_captured_locals.count(operand)
+                                ? StaticType::any
+                                : state.locals[operand]);
+      break;
+    case Bytecode::store:
+      state.locals[operand] = pop(state);
+      break;
+    case Bytecode::aload:
+      pop(state);
+      pop(state);
+      state.stack.push_back(StaticType::any);
+      break;
+    case Bytecode::astore:
+      pop(state);
+      pop(state);
+      pop(state);
+      break;
+    case Bytecode::call_tos:
+      // The callee may assign any global.
+      for (int i = 0; i <= operand; i++) pop(state);
+      state.stack.push_back(StaticType::any);
+      state.globals.clear();
+      break;
+    case Bytecode::spawn:
+    case Bytecode::join:
+      // The fiber may assign any global, at any time once it's spawned.
+      for (int i = 0; i <= operand; i++) pop(state);
+      state.stack.push_back(StaticType::any);
+      state.globals.clear();
+      break;
+    case Bytecode::ret:
+    case Bytecode::halt:
+      return;
+    default:
+      // Only runs on baseline code before it has been specialized.
+      UNREACHABLE();
+  }
+  propagate(next, state);
+}
+
+void TypeAnalysis::propagate(uint32_t offset, const State& state) {
+  State& to = m_states[offset];
+  if (!to.reached) {
+    to = state;
+    to.reached = true;
+    m_worklist.push_back(offset);
+    return;
+  }
+
+  bool changed = false;
+  auto join_into = [&changed](StaticType& to, StaticType from) {
+    StaticType t = join(to, from);
+    changed |= t != to;
+    to = t;
+  };
+
+  size_t height = std::min(to.stack.size(), state.stack.size());
+  if (height != to.stack.size()) {
+    to.stack.erase(to.stack.begin(), to.stack.end() - height);
+    changed = true;
+  }
+  for (size_t i = 0; i < height; i++) {
+    join_into(to.stack[i], state.stack[state.stack.size() - height + i]);
+  }
+
+  for (size_t i = 0; i < to.locals.size(); i++) {
+    join_into(to.locals[i], state.locals[i]);
+  }
+
+  if (to.globals.size() > state.globals.size()) {
+    to.globals.resize(state.globals.size());
+    changed = true;
+  }
+  for (size_t i = 0; i < to.globals.size(); i++) {
+    join_into(to.globals[i], state.globals[i]);
+  }
+
+  if (changed) m_worklist.push_back(offset);
+}
+
+StaticType TypeAnalysis::join(StaticType a, StaticType b) {
+  if (a == StaticType::none) return b;
+  if (b == StaticType::none || a == b) return a;
+  return StaticType::any;
+}
+
+StaticType TypeAnalysis::pop(State& state) {
+  if (state.stack.empty()) return StaticType::any;
+  StaticType t = state.stack.back();
+  state.stack.pop_back();
+  return t;
+}
+
+StaticType TypeAnalysis::peek(const State& state, int i) {
+  if (state.stack.size() <= (size_t)i) return StaticType::any;
+  return state.stack[state.stack.size() - 1 - i];
+}
+
+StaticType TypeAnalysis::constantType(const Value& val) {
+  if (val.isNumber()) return StaticType::number;
+  if (val.isBoolean()) return StaticType::boolean;
+  return StaticType::any;
+}
+
+}  // namespace Linaro
@@ -0,0 +1,68 @@
+#ifndef TYPE_ANALYSIS_H
+#define TYPE_ANALYSIS_H
+
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+#include "../vm/objects.h"
+#include "chunk.h"
+
+namespace Linaro {
+
+// What is known about a value at some point in a function.
+enum class StaticType : uint8_t { none, number, boolean, any };
+
+// Flow-sensitive type inference over the bytecode of a function. Instructions
+// whose operands are proven to always be numbers are rewritten into
+// specialized versions that work directly on the doubles.
+class TypeAnalysis {
+ public:
+  // Without 'track_globals' every global is 'any', for programs whose
+  // fibers may assign them at any time.
+  static void specialize(Function* fn, bool track_globals);
+  // Whether 'fn' may run code of its program on other fibers: it spawns,
+  // runs a parallel loop, or loads a built-in that calls functions on
+  // fibers.
+  static bool mayRunFibers(Function* fn);
+
+ private:
+  // Types at the start of an instruction.
+  struct State {
+    bool reached = false;
+    // Only the top of the operand stack is tracked, anything below it is
+    // 'any'. Paths that reach an instruction with different stack heights
+    // are joined at the top.
+    std::vector<StaticType> stack;
+    std::vector<StaticType> locals;
+    // Globals not in here are 'any'.
+    std::vector<StaticType> globals;
+  };
+
+  TypeAnalysis(Function* fn, bool track_globals);
+
+  void run();
+  void rewrite();
+
+  // Applies the instruction at 'offset' to 'state' and propagates the result
+  // to its successors.
+  void transfer(uint32_t offset, State state);
+  void propagate(uint32_t offset, const State& state);
+
+  static StaticType join(StaticType a, StaticType b);
+  static StaticType pop(State& state);
+  static StaticType peek(const State& state, int i = 0);
+  static StaticType constantType(const Value& val);
+
+  Function* m_fn;
+  BytecodeChunk* m_code;
+  bool m_track_globals;
+  std::vector<State> m_states;
+  std::vector<uint32_t> m_worklist;
+  // Locals captured by closures can change behind the function's back.
+  std::unordered_set<int> m_captured_locals;
+};
+
+}  // namespace Linaro
+
+#endif  // TYPE_ANALYSIS_H
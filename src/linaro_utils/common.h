@@ -8,6 +8,80 @@ const int MAX_PARAMETERS = 8;
 const int MAX_SYMBOL_NAME = 32;
 const int MAX_SYMBOL_PER_SCOPE = 64;
 
+// Inlining
+// Calls from a call site with the same callee before it is inlined.
+const int INLINE_CALL_THRESHOLD = 100;
+// Largest callee (in bytes of bytecode) that will be inlined.
+const int MAX_INLINE_BYTECODE_SIZE = 64;
+// Deepest nesting of inlined calls.
+const int MAX_INLINE_DEPTH = 3;
+
+// On-stack replacement
+// Iterations of a loop in baseline code before the running frame is moved
+// to optimized code.
+const int OSR_BACK_EDGE_THRESHOLD = 1000;
+
+// Parallel natives (pmap, preduce, pfilter)
+// Elements a chunk has at least, arrays with fewer than two chunks' worth are
+// processed on the calling thread.
+const int PARALLEL_MIN_CHUNK = 1024;
+// Chunks an array is split into per worker, so that workers finishing early
+// can steal the rest.
+const int PARALLEL_CHUNKS_PER_WORKER = 4;
+
+// Most reduction variables a parallel for loop can have.
+const int MAX_REDUCTIONS = 8;
+
+// Fibers
+// Locks the arrays are striped over once fibers run, see Array.
+const int ARRAY_LOCK_STRIPES = 64;
+// Locks the globals of an isolate are striped over, see Isolate.
+const int GLOBAL_LOCK_STRIPES = 64;
+
+// Cycle collector
+// Objects allocated before the first cycle starts. Later cycles start once
+// as many objects were allocated as were left after the last one.
+const int GC_MIN_TRIGGER = 10000;
+// Objects and references a step of a cycle visits before the script runs
+// again.
+const int GC_STEP_BUDGET = 2000;
+// Percentage of free nodes in the node table of the collector from which it
+// is compacted after a cycle, when node compaction is on.
+const int GC_NODE_COMPACTION_FRAGMENTATION = 25;
+
+// Nursery
+// Largest object (with its reference counts) allocated in the nursery, in
+// bytes. Larger ones go to malloc.
+const int NURSERY_MAX_OBJECT = 256;
+// Bytes a thread takes for the nursery at once.
+const int NURSERY_CHUNK_SIZE = 256 * 1024;
+// Free blocks of a size a thread keeps before it hands them to the others.
+const int NURSERY_MAX_FREE_BLOCKS = 4096;
+
+// Actors
+// Messages a mailbox holds before senders have to wait. A power of two.
+const int MAILBOX_CAPACITY = 1024;
+
+// Profiler
+// Rows of each table of the '--profile' and '--opcode-stats' reports.
+const int PROFILE_REPORT_ROWS = 20;
+
+// Allocation profiler
+// Sites listed by '--alloc-profile', the ones that allocated the most bytes.
+const int ALLOCATION_REPORT_SITES = 30;
+
+// Sampler
+// Samples a second of CPU time the sampling profiler takes by default.
+const int SAMPLER_DEFAULT_HZ = 1000;
+
+// Stats
+// Functions with the most constants listed by '--stats'.
+const int STATS_REPORT_FUNCTIONS = 10;
+
+// Tracer
+// Calls each thread keeps for '--trace', older ones are overwritten.
+const int TRACE_BUFFER_EVENTS = 1 << 18;
+
 // Debug
 
 #ifdef DEBUG
@@ -1,8 +1,12 @@
+#include <stdlib.h>
 #include <string.h>
 #include <ctime>
+#include <fstream>
 #include <iostream>
 #include <string_view>
+#include <thread>
 
+#include "aot/c_emitter.h"
 #include "ast/ast.h"
 #include "ast/expression.h"
 #include "ast/statement.h"
@@ -12,17 +16,194 @@
 #include "linaro_utils/utils.h"
 #include "parsing/lexer.h"
 #include "parsing/token.h"
+#include "vm/actor.h"
+#include "vm/allocation_profiler.h"
+#include "vm/opcode_stats.h"
+#include "vm/perf_counters.h"
+#include "vm/profiler.h"
+#include "vm/program.h"
+#include "vm/sampler.h"
+#include "vm/scheduler.h"
+#include "vm/tracer.h"
 #include "vm/value.h"
 #include "vm/vm.h"
 
 #define DEBUG_VM
 using namespace Linaro;
 
-int main() {
+// Writes the C translation of 'script' to 'output'.
+static int emitC(const char* script, std::string output) {
+  if (output.empty()) {
+    output = script;
+    size_t ext = output.rfind(".lo");
+    if (ext != std::string::npos && ext == output.size() - 3)
+      output.erase(ext);
+    output += ".c";
+  }
+  auto program = Program::compile(script);
+  std::ofstream out(output);
+  if (!out || !CEmitter::emit(program->topLevel(), script, out)) {
+    std::cerr << "Failed to emit " << output << '\n';
+    return 1;
+  }
+  return 0;
+}
+
+// Compiles 'script' once and runs it in 'num_isolates' VMs at the same
+// time, each on a thread of its own. Returns the status of the first VM
+// that failed, if any did.
+static VMEndingStatus runIsolates(const char* script, int num_isolates,
+                                  const VMOptions& options, RunStats* stats) {
+  auto program = Program::compile(script, stats);
+  std::cout << "\n---- OUTPUT ----\n\n";
+  PhaseTimer timer;
+  TraceSpan span("execute", "compiler");
+  std::vector<VMEndingStatus> results(num_isolates);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_isolates; i++) {
+    threads.emplace_back([program, &options, &results, i] {
+      VM vm;
+      vm.setOptions(options);
+      results[i] = vm.run(program);
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  if (stats != nullptr) stats->execute += timer.elapsed();
+  for (VMEndingStatus res : results) {
+    if (res != VMEndingStatus::VM_SUCCESS) return res;
+  }
+  return VMEndingStatus::VM_SUCCESS;
+}
+
+// Runs every script in 'scripts' as an actor, see ActorSystem.
+static VMEndingStatus runActors(const std::vector<const char*>& scripts,
+                                const VMOptions& options, RunStats* stats) {
+  std::vector<std::shared_ptr<const Program>> programs;
+  for (const char* script : scripts) {
+    programs.push_back(Program::compile(script, stats));
+  }
+  std::cout << "\n---- OUTPUT ----\n\n";
+  PhaseTimer timer;
+  TraceSpan span("execute", "compiler");
+  bool ok = ActorSystem(std::move(programs), options).run();
+  if (stats != nullptr) stats->execute += timer.elapsed();
+  return ok ? VMEndingStatus::VM_SUCCESS : VMEndingStatus::VM_RUNTIME_ERR;
+}
+
+static void usage() {
+  std::cerr << "usage: linaro [--isolates n] [--stats] "
+               "[--perf-counters[=calls]]\n"
+            << "              [--trace=file] [--alloc-profile[=n]] [--profile]\n"
+            << "              [--profile-json file] [--opcode-stats]\n"
+            << "              [--opcode-stats-json file]\n"
+            << "              [--sample file [--sample-rate hz]]\n"
+            << "              [--arena] [--gc-stats] [--gc-compact-nodes]\n"
+            << "              [--trace-deopt]\n"
+            << "              [script.lo]\n"
+            << "       linaro --actors [--arena] [--gc-stats]\n"
+            << "              [--gc-compact-nodes] [--trace-deopt] script.lo...\n"
+            << "       linaro --emit-c script.lo [-o script.c]\n";
+}
+
+int main(int argc, char* argv[]) {
+  const char* script = "script.lo";
+  bool emit_c = false;
+  int num_isolates = 0;
+  bool actors = false;
+  std::vector<const char*> scripts;
+  std::string output;
+  bool profile = false;
+  const char* profile_json = nullptr;
+  bool opcode_stats = false;
+  const char* opcode_stats_json = nullptr;
+  const char* samples = nullptr;
+  int sample_rate = SAMPLER_DEFAULT_HZ;
+  bool print_stats = false;
+  bool perf_counters = false;
+  const char* trace = nullptr;
+  // Records one of every 'alloc_profile' allocations, none if 0.
+  int alloc_profile = 0;
+  VMOptions options;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--emit-c") == 0) {
+      emit_c = true;
+    } else if (strcmp(argv[i], "--isolates") == 0 && i + 1 < argc) {
+      num_isolates = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--actors") == 0) {
+      actors = true;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+      trace = argv[i] + 8;
+    } else if (strcmp(argv[i], "--alloc-profile") == 0) {
+      alloc_profile = 1;
+    } else if (strncmp(argv[i], "--alloc-profile=", 16) == 0) {
+      alloc_profile = atoi(argv[i] + 16);
+      if (alloc_profile < 1) {
+        usage();
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      print_stats = true;
+    } else if (strcmp(argv[i], "--perf-counters") == 0 ||
+               strcmp(argv[i], "--perf-counters=calls") == 0) {
+      print_stats = perf_counters = true;
+      if (strchr(argv[i], '=') != nullptr) PerfCounters::setCountCalls(true);
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      profile = true;
+    } else if (strcmp(argv[i], "--profile-json") == 0 && i + 1 < argc) {
+      profile_json = argv[++i];
+    } else if (strcmp(argv[i], "--opcode-stats") == 0) {
+      opcode_stats = true;
+    } else if (strcmp(argv[i], "--opcode-stats-json") == 0 && i + 1 < argc) {
+      opcode_stats_json = argv[++i];
+    } else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) {
+      samples = argv[++i];
+    } else if (strcmp(argv[i], "--sample-rate") == 0 && i + 1 < argc) {
+      sample_rate = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--arena") == 0) {
+      options.arena = true;
+    } else if (strcmp(argv[i], "--gc-stats") == 0) {
+      options.print_gc_stats = true;
+    } else if (strcmp(argv[i], "--gc-compact-nodes") == 0) {
+      options.compact_nodes = true;
+    } else if (strcmp(argv[i], "--trace-deopt") == 0) {
+      options.trace_deopt = true;
+    } else if (argv[i][0] == '-') {
+      usage();
+      return 1;
+    } else {
+      script = argv[i];
+      scripts.push_back(script);
+    }
+  }
+  if (emit_c) return emitC(script, output);
+  if (profile || profile_json != nullptr || opcode_stats ||
+      opcode_stats_json != nullptr) {
+#ifdef LINARO_PROFILE
+    Profiler::enable(profile, profile_json);
+    OpcodeStats::enable(opcode_stats, opcode_stats_json);
+#else
+    std::cerr << "linaro was built without the profiler, configure it with "
+                 "-DLINARO_PROFILE=ON\n";
+    return 1;
+#endif
+  }
+
+  if (trace != nullptr) Tracer::enable();
+  if (alloc_profile > 0) AllocationProfiler::enable(alloc_profile);
+  std::string perf_error;
+  if (perf_counters && !PerfCounters::open(perf_error)) {
+    std::cerr << "Hardware counters are unavailable (" << perf_error
+              << "), only timing phases\n";
+    PerfCounters::setCountCalls(false);
+  }
+
   //  uint64_t t1 = 0;
   clock_t begin = clock();
+  VMEndingStatus res = VMEndingStatus::VM_SUCCESS;
 #ifdef DEBUG_LEXER
-  Lexer lex("script.lo");
+  Lexer lex(script);
   Token t = lex.nextToken();
   while (t.type() != TokenType::END) {
     std::cout << t << std::endl;
@@ -33,7 +214,7 @@ int main() {
 
 #ifdef DEBUG_PARSER
   // Parser debug code here
-  Parser parser("script.lo");
+  Parser parser(script);
   auto AST = parser.parse();
 
   AST->printNode();
@@ -41,26 +222,41 @@ int main() {
 
 #ifdef DEBUG_CODE_GENERATOR
   // Code generation debug code here
-  Parser parser("script.lo");
-  auto AST = parser.parse();
-  auto fn = CodeGenerator::compile(AST.get());
+  auto program = Program::compile(script);
 #ifdef DEBUG
-  auto functions = CodeGenerator::getFunctions();
   std::cout << "\n---- PROGRAM DEBUG ----\n\n";
-  for (const auto& fn : functions) {
-    fn->printFunction();
-  }
+  program->printFunctions();
 #endif
 #endif
 
 #ifdef DEBUG_VM
+  if (samples != nullptr) Sampler::start(sample_rate);
   VM vm;
-  vm.interpret("script.lo");
+  vm.setOptions(options);
+  if (getenv("LINARO_WORKERS") != nullptr)
+    Scheduler::setNumWorkers(atoi(getenv("LINARO_WORKERS")));
+  RunStats stats;
+  if (print_stats) vm.setStats(&stats);
+  if (actors)
+    res = runActors(scripts, options, print_stats ? &stats : nullptr);
+  else if (num_isolates > 0)
+    res = runIsolates(script, num_isolates, options,
+                      print_stats ? &stats : nullptr);
+  else
+    res = vm.interpret(script);
+  if (print_stats) stats.print(stderr);
   // VM debug code here
 #endif
+  if (Profiler::enabled()) Profiler::report();
+  if (OpcodeStats::enabled()) OpcodeStats::report();
+  if (AllocationProfiler::enabled()) AllocationProfiler::report();
+  if (samples != nullptr && !Sampler::stop(samples))
+    std::cerr << "Failed to write " << samples << '\n';
+  if (trace != nullptr && !Tracer::write(trace))
+    std::cerr << "Failed to write " << trace << '\n';
 
   clock_t end = clock();
   std::cout << "Execution time: " << double(end - begin) / CLOCKS_PER_SEC
             << "\n";
-  return 0;
+  return res == VMEndingStatus::VM_SUCCESS ? 0 : 1;
 }
@@ -79,6 +79,7 @@ Token Lexer::nextToken() {
   Token temp = getNextToken();
   temp.setHadNewlineBefore(b);
   temp.setLocation(save_loc);
+  if (temp.type() != TokenType::END) m_num_tokens++;
   return temp;
 }
 
@@ -134,6 +135,10 @@ Token Lexer::getNextToken() {
         advance();
         return constructToken(TokenType::COMMA);
       case '.':
+        if (peek() == '.') {
+          advance(2);
+          return constructToken(TokenType::RANGE);
+        }
         advance();
         return constructToken(TokenType::PERIOD);
       case ':':
@@ -244,6 +249,8 @@ Token Lexer::identifier() {
   if (result == "fn") return constructToken(TokenType::FUNCTION);
   if (result == "else") return constructToken(TokenType::ELSE);
   if (result == "for") return constructToken(TokenType::FOR);
+  if (result == "in") return constructToken(TokenType::IN);
+  if (result == "parallel") return constructToken(TokenType::PARALLEL);
   if (result == "while") return constructToken(TokenType::WHILE);
   if (result == "print") return constructToken(TokenType::PRINT);
   if (result == "ret") return constructToken(TokenType::RETURN);
@@ -294,7 +301,8 @@ Token Lexer::linaroString() {
     advance();
   }
 
-  return Token(TokenType::STRING, std::string_view(str));
+  m_strings.push_back(std::move(str));
+  return Token(TokenType::STRING, std::string_view(m_strings.back()));
 }
 
 }  // namespace Linaro
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <cstdint>
+#include <deque>
 #include <string>
 #include <string_view>
 
@@ -17,6 +19,8 @@ class Lexer {
   ~Lexer() {}
   Location& getLocation() { return m_current_location; }
   Token nextToken();
+  // Tokens returned so far, not counting the end of the source.
+  uint64_t numTokens() const { return m_num_tokens; }
   void readSource(const char* file) { m_source_code = readFile(file); }
 
  private:
@@ -47,6 +51,10 @@ class Lexer {
   size_t m_current = 0;
   char m_current_char;
   Location m_current_location;
+  uint64_t m_num_tokens = 0;
+  // String literals with their escape sequences resolved. Tokens refer to
+  // them, so they must not move.
+  std::deque<std::string> m_strings;
 };  // namespace linaro
 
 }  // namespace Linaro
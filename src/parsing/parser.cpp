@@ -7,6 +7,7 @@
 #include <string>
 #include <vector>
 
+#include "../vm/allocation_profiler.h"
 #include "lexer.h"
 #include "token.h"
 
@@ -28,7 +29,8 @@ FunctionLiteralPtr Parser::parse() {
     addStatement(main_block);
   }
   return std::make_unique<FunctionLiteral>(
-      FunctionType::top_level, "@main_function", main_args, main_block);
+      Location{loc().file, 0, 0}, FunctionType::top_level, "@main_function",
+      main_args, main_block);
 }
 
 void Parser::syntaxError(const Location& loc, const char* format, ...) {
@@ -84,8 +86,11 @@ Value Parser::constructValue(const Token& tok) {
       return Value(false);
     case TokenType::NUMBER:
       return Value(std::stod(std::string(tok.asString())));
-    case TokenType::STRING:
-      return Value(std::make_shared<String>(tok.asString()));
+    case TokenType::STRING: {
+      auto str = std::make_shared<String>(tok.asString());
+      AllocationProfiler::constant(str, tok.getLocation());
+      return Value(str);
+    }
     case TokenType::NOLL:
       return Value(ValueType::nNoll);
     default:
@@ -252,13 +257,17 @@ ExpressionPtr Parser::parseUnaryPostfixOperation(ExpressionPtr& left,
   // Unary postfix operators
   switch (tok.type()) {
     case TokenType::AMPERSAND:
-      // "&" means it's a async function call (run in seperate thread)
-      // Todo, create different AST nodes for concurrent/normal call and handle
-      // it here. (or maybe just introdude it as a call type).
-      // Currently does the same as a normal call.
-      if (peek() == TokenType::LPAREN) {
+      // "&(" means it's a async function call (run in seperate fiber)
+      if (currentToken() == TokenType::LPAREN) {
+        nextToken();
+        return parseCall(left, CallType::spawn);
+      }
+      break;
+    case TokenType::HASH:
+      // "#(" joins a fiber
+      if (currentToken() == TokenType::LPAREN) {
         nextToken();
-        return parseCall(left);
+        return parseCall(left, CallType::join);
       }
       break;
       // "(" means it's a norma function call
@@ -282,9 +291,9 @@ ExpressionPtr Parser::parseUnaryPostfixOperation(ExpressionPtr& left,
   return std::make_unique<NullExpression>();
 }
 
-ExpressionPtr Parser::parseCall(ExpressionPtr& left) {
+ExpressionPtr Parser::parseCall(ExpressionPtr& left, CallType type) {
   // parse arguments for the call
-  CallPtr call = std::make_unique<Call>(left);
+  CallPtr call = std::make_unique<Call>(left, type);
   if (currentToken() != TokenType::RPAREN) {
     do {
       call->addArgument(parseExpression());
@@ -296,6 +305,8 @@ ExpressionPtr Parser::parseCall(ExpressionPtr& left) {
 
 FunctionLiteralPtr Parser::parseFunctionLiteral(std::string_view name,
                                                 FunctionType type) {
+  // The 'fn' keyword or the name.
+  Location loc = previous_token.getLocation();
   consume(TokenType::LPAREN, "Expected '('");
   std::vector<Identifier> args;
   if (currentToken() != TokenType::RPAREN) {
@@ -307,11 +318,13 @@ FunctionLiteralPtr Parser::parseFunctionLiteral(std::string_view name,
 
   consume(TokenType::RPAREN, "Expected ')'");
   BlockPtr function_block = parseBlock();
-  return std::make_unique<FunctionLiteral>(type, name, args, function_block);
+  return std::make_unique<FunctionLiteral>(loc, type, name, args,
+                                           function_block);
 }
 
 ExpressionPtr Parser::parseArrayLiteral() {
-  ArrayLiteralPtr arr = std::make_unique<ArrayLiteral>();
+  ArrayLiteralPtr arr =
+      std::make_unique<ArrayLiteral>(previous_token.getLocation());
   if (currentToken() != TokenType::RCB) {
     do {
       arr->addElement(parseExpression());
@@ -331,6 +344,9 @@ StatementPtr Parser::parseStatement() {
       return parseBlock();
     case TokenType::WHILE:
       return parseWhileStatement();
+    case TokenType::FOR:
+    case TokenType::PARALLEL:
+      return parseForStatement();
     case TokenType::IF:
       return parseIfStatement();
     case TokenType::PRINT:
@@ -402,6 +418,50 @@ StatementPtr Parser::parseWhileStatement() {
   return std::make_unique<WhileStatement>(condition, block);
 }
 
+StatementPtr Parser::parseForStatement() {
+  bool is_parallel = match(TokenType::PARALLEL);
+  consume(TokenType::FOR, "Expected for after parallel");
+  Token variable = current_token;
+  consume(TokenType::SYMBOL, "Expected loop variable after for keyword");
+  consume(TokenType::IN, "Expected in after loop variable");
+  auto start = parseExpression();
+  consume(TokenType::RANGE, "Expected .. in range of for loop");
+  auto end = parseExpression();
+
+  // reduce(+ sum, * product, min lowest, max highest)
+  std::vector<Reduction> reductions;
+  if (is_parallel && currentToken() == TokenType::SYMBOL &&
+      current_token.asString() == "reduce") {
+    nextToken();
+    consume(TokenType::LPAREN, "Expected ( after reduce");
+    do {
+      ReductionOp op;
+      if (match(TokenType::ADD)) {
+        op = ReductionOp::add;
+      } else if (match(TokenType::MUL)) {
+        op = ReductionOp::mul;
+      } else if (currentToken() == TokenType::SYMBOL &&
+                 (current_token.asString() == "min" ||
+                  current_token.asString() == "max")) {
+        op = current_token.asString() == "min" ? ReductionOp::min
+                                               : ReductionOp::max;
+        nextToken();
+      } else {
+        syntaxError(current_token.getLocation(),
+                    "Expected +, *, min or max in reduce");
+        break;
+      }
+      reductions.push_back({op, current_token});
+      consume(TokenType::SYMBOL, "Expected reduction variable");
+    } while (match(TokenType::COMMA));
+    consume(TokenType::RPAREN, "Expected ) after reductions");
+  }
+
+  BlockPtr block = parseBlock();
+  return std::make_unique<ForStatement>(variable, start, end, block,
+                                        is_parallel, std::move(reductions));
+}
+
 // print/return
 template <class T>
 StatementPtr Parser::parseSingleExpressionStatement() {
@@ -15,6 +15,7 @@ class Parser {
   Parser(const char* filename);
   ~Parser() {}
   FunctionLiteralPtr parse();
+  uint64_t numTokens() const { return m_lex.numTokens(); }
 
  private:
   void syntaxError(const Location& loc, const char* format, ...);
@@ -47,7 +48,8 @@ class Parser {
   ExpressionPtr parseBinaryOperation(ExpressionPtr& left);
   ExpressionPtr parseUnaryPostfixOperation(ExpressionPtr& left,
                                            const Token& tok);
-  ExpressionPtr parseCall(ExpressionPtr& left);
+  ExpressionPtr parseCall(ExpressionPtr& left,
+                          CallType type = CallType::normal);
   FunctionLiteralPtr parseFunctionLiteral(std::string_view name,
                                           FunctionType type);
   ExpressionPtr parseArrayLiteral();
@@ -64,6 +66,8 @@ class Parser {
   BlockPtr parseBlock();
   StatementPtr parseIfStatement();
   StatementPtr parseWhileStatement();
+  // for i in a..b { }, and with 'parallel' in front of it.
+  StatementPtr parseForStatement();
 
   // return/print
   template <class T>
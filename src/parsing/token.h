@@ -25,6 +25,7 @@ namespace Linaro {
   T(COLON, ":", 0)                              \
   T(SEMICOLON, ";", 0)                          \
   T(PERIOD, ".", 16)                            \
+  T(RANGE, "..", 0)                             \
   T(CONDITIONAL, "?", 3)                        \
   T(INCR, "++", 16)                             \
   T(DECR, "--", 16)                             \
@@ -62,7 +63,9 @@ namespace Linaro {
   K(ELSE, "else", 0)                            \
   K(FOR, "for", 0)                              \
   K(IF, "if", 0)                                \
+  K(IN, "in", 0)                                \
   K(NEW, "new", 15)                             \
+  K(PARALLEL, "parallel", 0)                    \
   K(RETURN, "ret", 0)                           \
   K(THIS, "this", 0)                            \
   K(SUPER, "super", 0)                          \
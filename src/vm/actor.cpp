@@ -0,0 +1,162 @@
+#include "actor.h"
+
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+
+#include "scheduler.h"
+#include "vm.h"
+
+namespace Linaro {
+
+static_assert((MAILBOX_CAPACITY & (MAILBOX_CAPACITY - 1)) == 0,
+              "MAILBOX_CAPACITY has to be a power of two");
+
+// How long a waiting receiver sleeps before it checks whether the other
+// actors are done.
+static const std::chrono::milliseconds RECEIVE_POLL_INTERVAL{1};
+
+Mailbox::Mailbox() : m_cells(MAILBOX_CAPACITY) {
+  for (size_t i = 0; i < m_cells.size(); i++) {
+    m_cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+bool Mailbox::trySend(const Value& message) {
+  size_t pos = m_tail.load(std::memory_order_relaxed);
+  Cell* cell;
+  for (;;) {
+    cell = &m_cells[pos & (MAILBOX_CAPACITY - 1)];
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    if (sequence == pos) {
+      if (m_tail.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed))
+        break;
+    } else if (sequence < pos) {
+      return false;
+    } else {
+      pos = m_tail.load(std::memory_order_relaxed);
+    }
+  }
+  cell->message = message;
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  if (m_receiver_waiting.load()) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_sent.notify_one();
+  }
+  return true;
+}
+
+std::optional<Value> Mailbox::tryReceive() {
+  Cell& cell = m_cells[m_head & (MAILBOX_CAPACITY - 1)];
+  if (cell.sequence.load(std::memory_order_acquire) != m_head + 1)
+    return std::nullopt;
+  std::optional<Value> message = std::move(cell.message);
+  cell.message = Value();
+  cell.sequence.store(m_head + MAILBOX_CAPACITY, std::memory_order_release);
+  m_head++;
+  return message;
+}
+
+void Mailbox::waitFor(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(m_lock);
+  m_receiver_waiting.store(true);
+  Cell& cell = m_cells[m_head & (MAILBOX_CAPACITY - 1)];
+  m_sent.wait_for(lock, timeout, [this, &cell] {
+    return cell.sequence.load(std::memory_order_acquire) == m_head + 1;
+  });
+  m_receiver_waiting.store(false);
+}
+
+// Copies 'val' into 'out' so it can be handed to another isolate. Strings
+// and shareable frozen arrays are immutable and shared as they are, other
+// arrays are copied deeply, keeping arrays that are reached twice shared in
+// the copy. Returns false for values tied to the sending isolate.
+static bool transfer(const Value& val, Value& out,
+                     std::unordered_map<const Array*, Value>& copies) {
+  if (!val.isObject() || val.isString()) {
+    out = val;
+    return true;
+  }
+  if (!val.isArray()) return false;
+  const Array& arr = val.valueTo<Array>();
+  if (arr.isShareable()) {
+    out = val;
+    return true;
+  }
+  if (arr.isFrozen()) return false;
+  auto it = copies.find(&arr);
+  if (it != copies.end()) {
+    out = it->second;
+    return true;
+  }
+  auto copy = makeObject<Array>();
+  out = Value(std::shared_ptr<Object>(copy));
+  copies.emplace(&arr, out);
+  for (const auto& [key, elem] : arr.elements()) {
+    Value key_copy, elem_copy;
+    if (!transfer(key, key_copy, copies) || !transfer(elem, elem_copy, copies))
+      return false;
+    copy->insert(key_copy, elem_copy);
+  }
+  return true;
+}
+
+ActorSystem::ActorSystem(std::vector<std::shared_ptr<const Program>> programs,
+                         const VMOptions& options)
+    : m_programs{std::move(programs)}, m_options{options} {
+  for (size_t i = 0; i < m_programs.size(); i++) {
+    m_inboxes.push_back(std::make_unique<Inbox>());
+  }
+}
+
+bool ActorSystem::run() {
+  m_running = m_programs.size();
+  std::vector<VMEndingStatus> results(numActors());
+  std::vector<std::thread> threads;
+  for (int i = 0; i < numActors(); i++) {
+    threads.emplace_back([this, i, &results] {
+      VM vm;
+      vm.setOptions(m_options);
+      results[i] = vm.run(std::make_shared<Isolate>(m_programs[i], this, i));
+      m_running--;
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  return std::all_of(results.begin(), results.end(), [](VMEndingStatus res) {
+    return res == VMEndingStatus::VM_SUCCESS;
+  });
+}
+
+const char* ActorSystem::send(Isolate& from, int to, const Value& message) {
+  if (to < 0 || to >= numActors())
+    return "send() to an actor that doesn't exist.";
+  std::unordered_map<const Array*, Value> copies;
+  Value copy;
+  if (!transfer(message, copy, copies))
+    return "Only numbers, booleans, strings and arrays of them can be sent.";
+  Mailbox& mailbox = m_inboxes[to]->mailbox;
+  while (!mailbox.trySend(copy)) {
+    // The receiver may be waiting on one of our fibers.
+    if (!from.has_fibers || !Scheduler::get().runPending())
+      std::this_thread::yield();
+  }
+  return nullptr;
+}
+
+Value ActorSystem::receive(Isolate& self) {
+  Inbox& inbox = *m_inboxes[self.actor_id];
+  std::lock_guard<std::recursive_mutex> lock(inbox.receiving);
+  Mailbox& mailbox = inbox.mailbox;
+  for (;;) {
+    bool others_done = m_running == 1;
+    if (std::optional<Value> message = mailbox.tryReceive())
+      return std::move(*message);
+    // Anything the others sent before they finished has arrived by now.
+    if (others_done) return Value();
+    if (!self.has_fibers || !Scheduler::get().runPending())
+      mailbox.waitFor(RECEIVE_POLL_INTERVAL);
+  }
+}
+
+}  // namespace Linaro
@@ -0,0 +1,88 @@
+#ifndef ACTOR_H
+#define ACTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "program.h"
+
+namespace Linaro {
+
+// A bounded queue of messages with any number of senders and a single
+// receiver. Sending and receiving take no locks, the lock is only used to
+// put an idle receiver to sleep.
+class Mailbox {
+ public:
+  Mailbox();
+
+  // Returns false if the mailbox is full.
+  bool trySend(const Value& message);
+  // The next message, nothing if the mailbox is empty.
+  std::optional<Value> tryReceive();
+
+  // Blocks the receiver until something is sent or 'timeout' has passed.
+  void waitFor(std::chrono::milliseconds timeout);
+
+ private:
+  struct Cell {
+    // The position in the queue the cell holds a message for when it's one
+    // ahead of the position, or is free for when it's equal to it.
+    std::atomic<size_t> sequence;
+    Value message;
+  };
+
+  std::vector<Cell> m_cells;
+  std::atomic<size_t> m_tail{0};
+  // Only touched by the receiver.
+  size_t m_head = 0;
+
+  std::atomic<bool> m_receiver_waiting{false};
+  std::mutex m_lock;
+  std::condition_variable m_sent;
+};
+
+// Runs scripts as actors, each in an isolate of its own on a thread of its
+// own. Actors only share the messages they send each other.
+class ActorSystem {
+ public:
+  // Actor i runs programs[i], in a VM with 'options'.
+  ActorSystem(std::vector<std::shared_ptr<const Program>> programs,
+              const VMOptions& options);
+
+  // Returns once every actor has finished. Returns false if any of them
+  // failed.
+  bool run();
+
+  int numActors() const { return m_inboxes.size(); }
+
+  // Sends a transferable copy of 'message' to actor 'to', waiting while its
+  // mailbox is full. Returns an error message on failure, nullptr
+  // otherwise.
+  const char* send(Isolate& from, int to, const Value& message);
+
+  // Waits for the next message of actor 'self'. Returns undefined once
+  // every other actor has finished and the mailbox is empty.
+  Value receive(Isolate& self);
+
+ private:
+  std::vector<std::shared_ptr<const Program>> m_programs;
+  VMOptions m_options;
+  struct Inbox {
+    Mailbox mailbox;
+    // Fibers of an actor may receive too, but a mailbox has one receiver
+    // at a time. Recursive since a receiver runs fibers while it waits.
+    std::recursive_mutex receiving;
+  };
+
+  std::vector<std::unique_ptr<Inbox>> m_inboxes;
+  // Actors that haven't finished yet.
+  std::atomic<int> m_running{0};
+};
+
+}  // namespace Linaro
+
+#endif  // ACTOR_H
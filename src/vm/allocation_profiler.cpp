@@ -0,0 +1,235 @@
+#include "allocation_profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "../linaro_utils/common.h"
+#include "objects.h"
+#include "vm.h"
+
+namespace Linaro {
+
+namespace {
+
+struct Site {
+  std::string function;
+  std::string file;
+  int line;
+  ObjectType type;
+
+  bool operator<(const Site &other) const {
+    return std::tie(function, file, line, type) <
+           std::tie(other.function, other.file, other.line, other.type);
+  }
+};
+
+struct Counters {
+  uint64_t count = 0;
+  uint64_t bytes = 0;
+  uint64_t surviving = 0;
+};
+
+// A recorded object, until it's known whether it survives.
+struct Sample {
+  Counters *counters;
+  std::weak_ptr<Object> ref;
+  const Isolate *isolate;
+};
+
+struct ThreadProfile {
+  // Only contended while an isolate ends or the report is made.
+  std::mutex lock;
+  std::map<Site, Counters> sites;
+  std::vector<Sample> samples;
+  // The samples of objects that are gone are dropped once there are this
+  // many. Their memory isn't freed before.
+  size_t prune_at = 1024;
+  // Allocations left before the next one is recorded.
+  int countdown = 0;
+};
+
+struct Profiles {
+  std::mutex lock;
+  std::vector<std::unique_ptr<ThreadProfile>> threads;
+};
+
+}  // namespace
+
+// Never destroyed, threads may still allocate while the process exits.
+static Profiles &profiles() {
+  static Profiles *profiles = new Profiles();
+  return *profiles;
+}
+
+static thread_local ThreadProfile *t_profile = nullptr;
+
+static ThreadProfile &threadProfile() {
+  if (t_profile == nullptr) {
+    Profiles &all = profiles();
+    std::lock_guard<std::mutex> lock(all.lock);
+    all.threads.push_back(std::make_unique<ThreadProfile>());
+    t_profile = all.threads.back().get();
+  }
+  return *t_profile;
+}
+
+// Bytes of the object and of what it owns.
+static uint64_t bytesOf(Object &obj) {
+  if (obj.isString()) {
+    const std::string &str = static_cast<String &>(obj).str();
+    // Short strings are kept inside the object.
+    const char *begin = reinterpret_cast<const char *>(&obj);
+    bool inside = str.data() >= begin && str.data() < begin + sizeof(String);
+    return sizeof(String) + (inside ? 0 : str.capacity() + 1);
+  }
+  if (obj.isArray()) {
+    // A node of the hash table per element, and the buckets.
+    const auto &values = static_cast<Array &>(obj).getArray();
+    return sizeof(Array) +
+           values.size() *
+               (sizeof(std::pair<const Value, Value>) + 2 * sizeof(void *)) +
+           values.bucket_count() * sizeof(void *);
+  }
+  auto &closure = static_cast<Closure &>(obj);
+  return sizeof(Closure) + closure.getCapturedVariables().capacity() *
+                               sizeof(std::shared_ptr<CapturedVariable>);
+}
+
+void AllocationProfiler::enable(int sample_every) {
+  s_sample_every = std::max(sample_every, 1);
+  s_enabled = true;
+}
+
+void AllocationProfiler::record(const std::shared_ptr<Object> &obj,
+                                const Location *loc) {
+  ThreadProfile &profile = threadProfile();
+  if (--profile.countdown > 0) return;
+  profile.countdown = s_sample_every;
+
+  Site site{"(unknown)", "", -1, nString};
+  const Isolate *isolate = nullptr;
+  if (loc != nullptr) {
+    site.function = "(constant)";
+    site.file = loc->file;
+    site.line = loc->line;
+  } else if (s_vm != nullptr) {
+    Location at = s_vm->currentLocation();
+    site.function = s_vm->currentFunction()->name();
+    site.file = at.file;
+    site.line = at.line;
+    isolate = s_vm->isolate();
+  }
+  if (obj->isArray())
+    site.type = nArray;
+  else if (obj->isClosure())
+    site.type = nClosure;
+
+  std::lock_guard<std::mutex> lock(profile.lock);
+  Counters &counters = profile.sites[site];
+  counters.count += s_sample_every;
+  counters.bytes += s_sample_every * bytesOf(*obj);
+  profile.samples.push_back({&counters, obj, isolate});
+  if (profile.samples.size() >= profile.prune_at) {
+    auto &samples = profile.samples;
+    samples.erase(std::remove_if(samples.begin(), samples.end(),
+                                 [](const Sample &sample) {
+                                   return sample.ref.expired();
+                                 }),
+                  samples.end());
+    profile.prune_at = std::max<size_t>(1024, 2 * samples.size());
+  }
+}
+
+void AllocationProfiler::constant(const std::shared_ptr<String> &str,
+                                  const Location &loc) {
+  if (s_enabled) record(str, &loc);
+}
+
+void AllocationProfiler::endIsolate(const Isolate *isolate) {
+  if (!s_enabled) return;
+  Profiles &all = profiles();
+  std::lock_guard<std::mutex> lock(all.lock);
+  for (const auto &profile : all.threads) {
+    std::lock_guard<std::mutex> thread_lock(profile->lock);
+    auto &samples = profile->samples;
+    // Constants belong to no isolate, they survive as long as the program.
+    auto ended = std::partition(
+        samples.begin(), samples.end(), [isolate](const Sample &sample) {
+          return sample.isolate != isolate && sample.isolate != nullptr;
+        });
+    for (auto it = ended; it != samples.end(); it++) {
+      if (std::shared_ptr<Object> obj = it->ref.lock())
+        it->counters->surviving += s_sample_every * bytesOf(*obj);
+    }
+    samples.erase(ended, samples.end());
+  }
+}
+
+static const char *typeName(ObjectType type) {
+  switch (type) {
+    case nString:
+      return "string";
+    case nArray:
+      return "array";
+    case nClosure:
+      return "closure";
+    default:
+      UNREACHABLE();
+  }
+  return nullptr;
+}
+
+void AllocationProfiler::report() {
+  std::map<Site, Counters> sites;
+  Profiles &all = profiles();
+  {
+    std::lock_guard<std::mutex> lock(all.lock);
+    for (const auto &profile : all.threads) {
+      std::lock_guard<std::mutex> thread_lock(profile->lock);
+      for (const auto &[site, counters] : profile->sites) {
+        Counters &total = sites[site];
+        total.count += counters.count;
+        total.bytes += counters.bytes;
+        total.surviving += counters.surviving;
+      }
+    }
+  }
+  std::vector<std::pair<Site, Counters>> rows(sites.begin(), sites.end());
+  std::sort(rows.begin(), rows.end(), [](const auto &a, const auto &b) {
+    return a.second.bytes > b.second.bytes;
+  });
+  Counters total;
+  for (const auto &[site, counters] : rows) {
+    total.count += counters.count;
+    total.bytes += counters.bytes;
+    total.surviving += counters.surviving;
+  }
+
+  fprintf(stderr, "\n---- ALLOCATIONS ----\n\n");
+  fprintf(stderr, "%llu objects, %llu bytes, %llu bytes surviving",
+          (unsigned long long)total.count, (unsigned long long)total.bytes,
+          (unsigned long long)total.surviving);
+  if (s_sample_every > 1)
+    fprintf(stderr, " (1 in %d allocations recorded)", s_sample_every);
+  fprintf(stderr, "\n\n%-40s %-8s %12s %14s %7s %14s\n", "site", "kind",
+          "count", "bytes", "%", "surviving");
+  int printed = 0;
+  for (const auto &[site, counters] : rows) {
+    if (printed++ == ALLOCATION_REPORT_SITES) break;
+    std::string name = site.function;
+    if (site.line >= 0)
+      name += " " + site.file + ":" + std::to_string(site.line);
+    fprintf(stderr, "%-40s %-8s %12llu %14llu %6.2f%% %14llu\n", name.c_str(),
+            typeName(site.type), (unsigned long long)counters.count,
+            (unsigned long long)counters.bytes,
+            total.bytes == 0 ? 0.0 : 100.0 * counters.bytes / total.bytes,
+            (unsigned long long)counters.surviving);
+  }
+}
+
+}  // namespace Linaro
@@ -0,0 +1,64 @@
+#ifndef ALLOCATION_PROFILER_H
+#define ALLOCATION_PROFILER_H
+
+#include <memory>
+
+namespace Linaro {
+
+struct Isolate;
+class Object;
+class String;
+class VM;
+struct Location;
+
+// Attributes the strings, arrays and closures the scripts create to the
+// function and line that created them, and reports how many objects and
+// bytes each of these sites allocated. Bytes include what the object owns,
+// like the characters of a long string or the elements of an array. An
+// object survives if it's still there when the script of its isolate is
+// done, and then counts with its size at that point.
+//
+// Only one of every 'sample_every' allocations of a thread is recorded, and
+// its numbers are scaled up by as much.
+class AllocationProfiler {
+ public:
+  static void enable(int sample_every);
+  static inline bool enabled() { return s_enabled; }
+
+  // Called with every string, array and closure once it's filled in.
+  template <typename T>
+  static inline void allocated(const std::shared_ptr<T> &obj) {
+    if (s_enabled) record(obj, nullptr);
+  }
+  // Called with the string constants of a program, found at 'loc'.
+  static void constant(const std::shared_ptr<String> &str,
+                       const Location &loc);
+
+  // Counts the recorded objects of 'isolate' that are still there as
+  // surviving, and forgets them. Called once its script is done.
+  static void endIsolate(const Isolate *isolate);
+
+  static void report();
+
+  // Attributes the allocations of the calling thread to the instruction
+  // 'vm' runs, for as long as it lives.
+  class Scope {
+   public:
+    explicit Scope(VM *vm) : m_previous{s_vm} { s_vm = vm; }
+    ~Scope() { s_vm = m_previous; }
+
+   private:
+    VM *m_previous;
+  };
+
+ private:
+  static void record(const std::shared_ptr<Object> &obj, const Location *loc);
+
+  static inline bool s_enabled = false;
+  static inline int s_sample_every = 1;
+  static inline thread_local VM *s_vm = nullptr;
+};
+
+}  // namespace Linaro
+
+#endif  // ALLOCATION_PROFILER_H
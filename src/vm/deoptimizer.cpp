@@ -0,0 +1,46 @@
+#include "deoptimizer.h"
+
+#include <algorithm>
+#include <tuple>
+
+#include "objects.h"
+
+namespace Linaro {
+
+#define R(name, description) description,
+static const char* const deopt_reason_to_string[]{DEOPT_REASONS(R)};
+#undef R
+
+const char* DeoptStats::reasonToString(DeoptReason reason) {
+  CHECK(reason < DeoptReason::NUM_REASONS);
+  return deopt_reason_to_string[(uint8_t)reason];
+}
+
+bool DeoptStats::Guard::operator<(const Guard& other) const {
+  return std::tie(function, baseline_offset, reason) <
+         std::tie(other.function, other.baseline_offset, other.reason);
+}
+
+void DeoptStats::record(const Function* fn, uint32_t baseline_offset,
+                        DeoptReason reason) {
+  m_guards[{std::string(fn->name()), baseline_offset, reason}]++;
+  m_total++;
+}
+
+void DeoptStats::print(FILE* out) const {
+  fprintf(out, "---- DEOPTIMIZATIONS (%llu) ----\n",
+          (unsigned long long)m_total);
+  std::vector<std::pair<Guard, uint64_t>> guards(m_guards.begin(),
+                                                 m_guards.end());
+  std::stable_sort(guards.begin(), guards.end(),
+                   [](const auto& a, const auto& b) {
+                     return a.second > b.second;
+                   });
+  for (const auto& [guard, count] : guards) {
+    fprintf(out, "%8llu  %s @%u: %s\n", (unsigned long long)count,
+            guard.function.c_str(), guard.baseline_offset,
+            reasonToString(guard.reason));
+  }
+}
+
+}  // namespace Linaro
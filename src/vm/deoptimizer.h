@@ -0,0 +1,71 @@
+#ifndef DEOPTIMIZER_H
+#define DEOPTIMIZER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Linaro {
+
+class Function;
+
+// Why optimized code gave up and went back to baseline code.
+#define DEOPT_REASONS(R) R(wrong_callee, "callee binding changed")
+
+#define R(name, description) name,
+enum class DeoptReason : uint8_t { DEOPT_REASONS(R) NUM_REASONS };
+#undef R
+
+// An inlined function that is active at a guard. Everything needed to turn
+// it back into a StackFrame of its own.
+struct InlinedFrameState {
+  Function* fn;
+  // Where the locals of the inlined function start in the local space of
+  // the frame running the optimized code.
+  uint16_t local_base;
+  // Slot holding the closure the inlined function was entered with.
+  uint16_t closure_slot;
+  // Offset in the baseline code of the caller to continue at once the
+  // inlined function has returned (right after its call_tos).
+  uint32_t return_offset;
+};
+
+// Describes the interpreter state that a guard in optimized code corresponds
+// to. The operand stack of optimized code is always laid out exactly as in
+// the baseline code, so only the frames and the instruction pointer have to
+// be recorded.
+struct FrameState {
+  // Offset in the baseline code of the innermost frame to resume at.
+  uint32_t baseline_offset;
+  // Inlined frames active at the guard, outermost first. Empty if the guard
+  // belongs to the function that owns the optimized code.
+  std::vector<InlinedFrameState> inlined_frames;
+};
+
+// Counts how often each guard has failed.
+class DeoptStats {
+ public:
+  void record(const Function* fn, uint32_t baseline_offset,
+              DeoptReason reason);
+  uint64_t total() const { return m_total; }
+  void print(FILE* out) const;
+
+  static const char* reasonToString(DeoptReason reason);
+
+ private:
+  struct Guard {
+    std::string function;
+    uint32_t baseline_offset;
+    DeoptReason reason;
+    bool operator<(const Guard& other) const;
+  };
+
+  std::map<Guard, uint64_t> m_guards;
+  uint64_t m_total = 0;
+};
+
+}  // namespace Linaro
+
+#endif  // DEOPTIMIZER_H
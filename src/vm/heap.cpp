@@ -0,0 +1,390 @@
+#include "heap.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#include "tracer.h"
+#include "vm.h"
+
+namespace Linaro {
+
+using Clock = std::chrono::steady_clock;
+
+static uint64_t nanosecondsSince(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                              start)
+      .count();
+}
+
+/* PauseHistogram */
+
+static int bucketOf(uint64_t ns) {
+  if (ns < 4) return (int)ns;
+  int log = 63 - __builtin_clzll(ns);
+  return 4 * log + (int)((ns >> (log - 2)) & 3);
+}
+
+static uint64_t bucketLimit(int bucket) {
+  if (bucket < 4 * 2) return bucket;
+  int log = bucket / 4;
+  uint64_t limit = (uint64_t)(4 + bucket % 4 + 1) << (log - 2);
+  return limit - 1;
+}
+
+void PauseHistogram::record(uint64_t ns) {
+  m_buckets[bucketOf(ns)]++;
+  m_count++;
+  m_max = std::max(m_max, ns);
+}
+
+uint64_t PauseHistogram::percentile(double p) const {
+  if (m_count == 0) return 0;
+  uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(p / 100 * m_count));
+  uint64_t seen = 0;
+  for (int i = 0; i < NUM_BUCKETS; i++) {
+    seen += m_buckets[i];
+    if (seen >= rank) return std::min(bucketLimit(i), m_max);
+  }
+  return m_max;
+}
+
+void GcStats::print(FILE* out) const {
+  fprintf(out, "---- GC (%llu cycles, %llu objects freed) ----\n",
+          (unsigned long long)cycles, (unsigned long long)freed);
+  fprintf(out, "pauses: %llu  p50: %.1fus  p99: %.1fus  max: %.1fus\n",
+          (unsigned long long)pauses.count(), pauses.percentile(50) / 1e3,
+          pauses.percentile(99) / 1e3, pauses.max() / 1e3);
+  fprintf(out,
+          "fragmentation: nodes %.1f%%  nursery %.1f%%  "
+          "(%llu node table compactions)\n",
+          node_fragmentation * 100, nursery_fragmentation * 100,
+          (unsigned long long)node_compactions);
+}
+
+/* Heap */
+
+void Heap::track(const std::shared_ptr<Array>& arr) {
+  Object* obj = arr.get();
+  obj->setHeapIndex(track(arr, obj, Kind::array));
+}
+
+void Heap::track(const std::shared_ptr<Closure>& closure) {
+  Object* obj = closure.get();
+  obj->setHeapIndex(track(closure, obj, Kind::closure));
+}
+
+void Heap::track(const std::shared_ptr<CapturedVariable>& cv) {
+  cv->heap_index = track(cv, cv.get(), Kind::captured_variable);
+}
+
+uint32_t Heap::track(std::weak_ptr<void> ref, void* ptr, Kind kind) {
+  std::lock_guard<std::mutex> lock(m_lock);
+  m_allocated++;
+  // Nodes reused during a cycle would look like they take part in it.
+  if (m_phase == Phase::idle && !m_free.empty()) {
+    uint32_t i = m_free.back();
+    m_free.pop_back();
+    m_nodes[i] = {std::move(ref), ptr, kind};
+    return i;
+  }
+  m_nodes.push_back({std::move(ref), ptr, kind});
+  return m_nodes.size() - 1;
+}
+
+void Heap::writeBarrier(const CapturedVariable* cv) {
+  if (m_phase != Phase::idle) shade(nodeOf(cv));
+}
+
+uint32_t Heap::nodeOf(const CapturedVariable* cv) const {
+  uint32_t i = cv->heap_index;
+  return i < m_num_cycle_nodes && m_nodes[i].ptr == cv ? i : NO_NODE;
+}
+
+template <typename F>
+int Heap::forEachChild(const Node& node, F f) const {
+  auto value = [this, &f](const Value& val) {
+    if (!val.isObject()) return;
+    uint32_t child = nodeOf(val.valueTo<Object>());
+    if (child != NO_NODE) f(child);
+  };
+  switch (node.kind) {
+    case Kind::array: {
+      auto& arr = *static_cast<Array*>(static_cast<Object*>(node.ptr));
+      for (const auto& [key, elem] : arr.getArray()) {
+        value(key);
+        value(elem);
+      }
+      return 2 * arr.size();
+    }
+    case Kind::closure: {
+      auto& closure = *static_cast<Closure*>(static_cast<Object*>(node.ptr));
+      for (const auto& cv : closure.getCapturedVariables()) {
+        uint32_t child = nodeOf(cv.get());
+        if (child != NO_NODE) f(child);
+      }
+      return closure.getCapturedVariables().size();
+    }
+    case Kind::captured_variable:
+      value(static_cast<CapturedVariable*>(node.ptr)->closed);
+      return 1;
+  }
+  UNREACHABLE();
+  return 0;
+}
+
+int Heap::clear(const Node& node) {
+  switch (node.kind) {
+    case Kind::array: {
+      auto& arr = *static_cast<Array*>(static_cast<Object*>(node.ptr));
+      int size = arr.size();
+      arr.clear();
+      return 2 * size;
+    }
+    case Kind::closure: {
+      auto& cvs = static_cast<Closure*>(static_cast<Object*>(node.ptr))
+                      ->getCapturedVariables();
+      int size = cvs.size();
+      cvs.clear();
+      return size;
+    }
+    case Kind::captured_variable:
+      static_cast<CapturedVariable*>(node.ptr)->closed = Value();
+      return 1;
+  }
+  UNREACHABLE();
+  return 0;
+}
+
+void Heap::freeNode(uint32_t i) {
+  m_nodes[i] = {std::weak_ptr<void>(), nullptr, m_nodes[i].kind};
+  m_freed_nodes.push_back(i);
+}
+
+void Heap::shade(uint32_t node) {
+  if (node == NO_NODE || m_colors[node] != white) return;
+  m_colors[node] = gray;
+  m_gray.push_back(node);
+}
+
+void Heap::step() {
+  TraceSpan span("gc step", "gc");
+  Clock::time_point start = Clock::now();
+  if (m_phase == Phase::idle) beginCycle();
+  if (advance(GC_STEP_BUDGET)) endCycle();
+  m_stats.pauses.record(nanosecondsSince(start));
+}
+
+uint64_t Heap::collect() {
+  TraceSpan span("gc collect", "gc");
+  Clock::time_point start = Clock::now();
+  uint64_t freed = 0;
+  // What the cycle in progress has marked may have become garbage since.
+  if (m_phase != Phase::idle) {
+    advance(std::numeric_limits<int64_t>::max());
+    freed += endCycle();
+  }
+  beginCycle();
+  advance(std::numeric_limits<int64_t>::max());
+  freed += endCycle();
+  m_stats.pauses.record(nanosecondsSince(start));
+  return freed;
+}
+
+void Heap::beginCycle() {
+  if (Tracer::enabled()) {
+    m_trace_id = Tracer::newId();
+    Tracer::asyncBegin("gc cycle", "gc", m_trace_id);
+  }
+  m_phase = Phase::counting;
+  m_num_cycle_nodes = m_nodes.size();
+  m_cursor = 0;
+  m_allocated = 0;
+  m_num_gathered = 0;
+  m_internal.assign(m_num_cycle_nodes, 0);
+  m_colors.assign(m_num_cycle_nodes, white);
+}
+
+bool Heap::advance(int64_t budget) {
+  // Nothing is freed while the cycle is marked, so nodes that aren't expired
+  // can be used without locking them.
+  auto count_reference = [this](uint32_t child) { m_internal[child]++; };
+  auto shade_reference = [this](uint32_t child) { shade(child); };
+
+  while (budget > 0) {
+    if (m_phase == Phase::freeing) {
+      if (m_cursor == m_candidates.size()) return true;
+    } else if (m_phase != Phase::marking && m_cursor == m_num_cycle_nodes) {
+      m_cursor = 0;
+      switch (m_phase) {
+        case Phase::counting:
+          m_phase = Phase::rooting;
+          break;
+        case Phase::rooting:
+          m_phase = Phase::marking;
+          break;
+        case Phase::gathering:
+          budget -= checkCandidates();
+          m_phase = Phase::freeing;
+          break;
+        default:
+          UNREACHABLE();
+      }
+      continue;
+    }
+    budget--;
+    switch (m_phase) {
+      case Phase::counting: {
+        uint32_t i = m_cursor++;
+        Node& node = m_nodes[i];
+        if (node.ptr == nullptr) break;
+        if (node.ref.expired()) {
+          // Lets go of the memory of the object, which the weak reference
+          // holds on to.
+          freeNode(i);
+          break;
+        }
+        budget -= forEachChild(node, count_reference);
+        break;
+      }
+      case Phase::rooting: {
+        // Referenced from outside the heap.
+        uint32_t i = m_cursor++;
+        const Node& node = m_nodes[i];
+        if (m_colors[i] == white && node.ptr != nullptr &&
+            node.ref.use_count() > m_internal[i]) {
+          m_colors[i] = gray;
+          m_gray.push_back(i);
+        }
+        break;
+      }
+      case Phase::marking: {
+        if (m_gray.empty()) {
+          m_phase = Phase::gathering;
+          break;
+        }
+        uint32_t i = m_gray.back();
+        m_gray.pop_back();
+        m_colors[i] = black;
+        const Node& node = m_nodes[i];
+        if (node.ptr != nullptr && !node.ref.expired())
+          budget -= forEachChild(node, shade_reference);
+        break;
+      }
+      case Phase::gathering: {
+        uint32_t i = m_cursor++;
+        Node& node = m_nodes[i];
+        if (node.ptr == nullptr) break;
+        std::shared_ptr<void> obj = node.ref.lock();
+        if (obj == nullptr) {
+          freeNode(i);
+        } else {
+          m_num_gathered++;
+          if (m_colors[i] == white) m_candidates.push_back({i, std::move(obj)});
+        }
+        break;
+      }
+      case Phase::freeing: {
+        // Clearing breaks the cycles. An object is freed once it's released
+        // and the candidates referencing it are cleared. The script can't
+        // reach any of them any more.
+        auto& [i, obj] = m_candidates[m_cursor++];
+        budget -= clear(m_nodes[i]);
+        obj = nullptr;
+        break;
+      }
+      default:
+        UNREACHABLE();
+    }
+  }
+  return false;
+}
+
+int64_t Heap::checkCandidates() {
+  // The script has changed the heap while it was marked, so the white
+  // candidates are counted again, this time all at once. Those referenced
+  // from outside the candidates (not counting our own reference), and
+  // everything they reference, are live. The rest is only referenced by
+  // garbage. Candidates shaded since they were gathered are live too.
+  int64_t work = 0;
+  for (const auto& [i, obj] : m_candidates) m_internal[i] = 0;
+  for (const auto& [i, obj] : m_candidates) {
+    if (m_colors[i] != white) continue;
+    work += forEachChild(m_nodes[i], [this](uint32_t child) {
+      if (m_colors[child] == white) m_internal[child]++;
+    });
+  }
+  std::vector<uint32_t> live;
+  for (const auto& [i, obj] : m_candidates) {
+    if (m_colors[i] != white || obj.use_count() - 1 > m_internal[i]) {
+      m_colors[i] = black;
+      live.push_back(i);
+    }
+  }
+  while (!live.empty()) {
+    uint32_t i = live.back();
+    live.pop_back();
+    work += forEachChild(m_nodes[i], [this, &live](uint32_t child) {
+      if (m_colors[child] != white) return;
+      m_colors[child] = black;
+      live.push_back(child);
+    });
+  }
+  auto garbage_end = std::remove_if(
+      m_candidates.begin(), m_candidates.end(),
+      [this](const auto& candidate) { return m_colors[candidate.first] != white; });
+  m_candidates.erase(garbage_end, m_candidates.end());
+  return work + m_candidates.size();
+}
+
+uint64_t Heap::endCycle() {
+  if (Tracer::enabled()) Tracer::asyncEnd("gc cycle", "gc", m_trace_id);
+  uint64_t freed = m_candidates.size();
+  m_candidates.clear();
+  std::lock_guard<std::mutex> lock(m_lock);
+  m_free.insert(m_free.end(), m_freed_nodes.begin(), m_freed_nodes.end());
+  m_freed_nodes.clear();
+  m_phase = Phase::idle;
+  m_gray.clear();
+  m_trigger = std::max<int64_t>(GC_MIN_TRIGGER, m_num_gathered - freed);
+  m_stats.cycles++;
+  m_stats.freed += freed;
+  if (!m_nodes.empty())
+    m_stats.node_fragmentation = (double)m_free.size() / m_nodes.size();
+  m_stats.nursery_fragmentation = Nursery::fragmentation();
+  if (m_compact_nodes && m_nodes.size() >= (size_t)GC_MIN_TRIGGER &&
+      m_free.size() * 100 >=
+          m_nodes.size() * GC_NODE_COMPACTION_FRAGMENTATION)
+    compactNodes();
+  return freed;
+}
+
+void Heap::compactNodes() {
+  uint32_t live = 0;
+  for (uint32_t i = 0; i < m_nodes.size(); i++) {
+    Node& node = m_nodes[i];
+    if (node.ptr == nullptr) continue;
+    std::shared_ptr<void> obj = node.ref.lock();
+    if (obj == nullptr) continue;
+    if (node.kind == Kind::captured_variable) {
+      static_cast<CapturedVariable*>(node.ptr)->heap_index = live;
+    } else {
+      // Other isolates may be reading the index of a shared frozen array.
+      // Once it's stale, nodeOf() doesn't find the array any more, so it's a
+      // root from then on.
+      Object* o = static_cast<Object*>(node.ptr);
+      if (!o->isArray() || !static_cast<Array*>(o)->isShareable())
+        o->setHeapIndex(live);
+    }
+    if (live != i) m_nodes[live] = std::move(node);
+    live++;
+  }
+  m_nodes.erase(m_nodes.begin() + live, m_nodes.end());
+  m_nodes.shrink_to_fit();
+  m_free.clear();
+  m_stats.node_compactions++;
+  Nursery::sortFreeLists();
+}
+
+}  // namespace Linaro
@@ -0,0 +1,201 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "objects.h"
+
+namespace Linaro {
+
+struct CapturedVariable;  // See vm.h
+
+// Durations of the pauses of the collector, in buckets of a quarter of a
+// power of two nanoseconds.
+class PauseHistogram {
+ public:
+  void record(uint64_t ns);
+  uint64_t count() const { return m_count; }
+  uint64_t max() const { return m_max; }
+  // Upper bound of the bucket holding the pause at percentile 'p' (0-100).
+  uint64_t percentile(double p) const;
+
+ private:
+  static const int NUM_BUCKETS = 4 * 64;
+  uint64_t m_buckets[NUM_BUCKETS] = {};
+  uint64_t m_count = 0;
+  uint64_t m_max = 0;
+};
+
+struct GcStats {
+  uint64_t cycles = 0;
+  // Objects whose references were cleared to break a garbage cycle.
+  uint64_t freed = 0;
+  uint64_t node_compactions = 0;
+  // Every step of the collector, and every full collection.
+  PauseHistogram pauses;
+  // Share of free nodes in the node table, and of free bytes in the nursery
+  // of the process (see Nursery::fragmentation()), from 0 to 1, at the end of
+  // the last cycle. Node compaction is decided on the first.
+  double node_fragmentation = 0;
+  double nursery_fragmentation = 0;
+
+  void print(FILE* out) const;
+};
+
+// Frees the cycles of arrays, closures and captured variables that
+// reference counting can't.
+//
+// A cycle finds the objects only referenced by other objects of the heap,
+// by counting the references between them and comparing the counts with the
+// reference counts (trial deletion). Objects referenced from anywhere else,
+// like the stacks of the VMs, are gray and every object reachable from them
+// is marked black. The work is split into steps of GC_STEP_BUDGET objects
+// and references that run at the allocation safepoints of the VM, so the
+// script changes the heap between steps. Write barriers shade what is
+// stored during a cycle, and what's left white is only a candidate: a final
+// step recounts the references of the white objects, and only clears the
+// ones that really are referenced by garbage alone.
+//
+// With node compaction on, the node table is compacted after a cycle once
+// GC_NODE_COMPACTION_FRAGMENTATION percent of it is free: the nodes of the
+// objects still there slide to the front in allocation order, and the
+// nursery free lists of the thread are sorted by address. Only the table
+// shrinks, objects themselves never move (shared_ptrs and raw pointers to
+// them are everywhere), so objects that are already live are not brought
+// any closer together.
+class Heap {
+ public:
+  Heap() = default;
+  Heap(const Heap&) = delete;
+  Heap& operator=(const Heap&) = delete;
+
+  // Objects that can be part of a cycle have to be tracked once they are
+  // allocated. Any thread of the isolate may track objects.
+  void track(const std::shared_ptr<Array>& arr);
+  void track(const std::shared_ptr<Closure>& closure);
+  void track(const std::shared_ptr<CapturedVariable>& cv);
+
+  // Called with every value stored into an array, a global or a captured
+  // variable, and every captured variable added to a closure.
+  inline void writeBarrier(const Value& val) {
+    if (m_phase != Phase::idle && val.isObject())
+      shade(nodeOf(val.valueTo<Object>()));
+  }
+  void writeBarrier(const CapturedVariable* cv);
+
+  // Starts a cycle once enough objects have been allocated since the last
+  // one, and runs one step of the cycle in progress. Only called while no
+  // other thread runs in the isolate.
+  inline void safepoint() {
+    if (m_phase != Phase::idle || m_allocated >= m_trigger) step();
+  }
+
+  // Finishes the cycle in progress, if any, and runs a whole one. Returns
+  // the number of objects freed.
+  uint64_t collect();
+
+  void setNodeCompaction(bool compact) { m_compact_nodes = compact; }
+
+  const GcStats& stats() const { return m_stats; }
+
+ private:
+  enum class Phase : uint8_t {
+    idle,
+    counting,
+    rooting,
+    marking,
+    gathering,
+    freeing
+  };
+  enum class Kind : uint8_t { array, closure, captured_variable };
+  enum Color : uint8_t { white, gray, black };
+
+  static const uint32_t NO_NODE = UINT32_MAX;
+
+  struct Node {
+    // Doesn't keep the object alive, so it doesn't add to its count.
+    std::weak_ptr<void> ref;
+    // Null once the node is free.
+    void* ptr;
+    Kind kind;
+  };
+
+  // Returns the node of the object.
+  uint32_t track(std::weak_ptr<void> ref, void* ptr, Kind kind);
+
+  // The node of a tracked object that takes part in the cycle in progress,
+  // or NO_NODE. The index stored in the object may belong to some other
+  // isolate if it's a shared frozen array.
+  inline uint32_t nodeOf(const Object& obj) const {
+    uint32_t i = obj.heapIndex();
+    return i < m_num_cycle_nodes && m_nodes[i].ptr == &obj ? i : NO_NODE;
+  }
+  uint32_t nodeOf(const CapturedVariable* cv) const;
+
+  void step();
+  void beginCycle();
+  // Does up to 'budget' units of work of the cycle in progress. Returns true
+  // once only endCycle() is left.
+  bool advance(int64_t budget);
+  // Drops the candidates that aren't garbage after all. Returns the work
+  // done.
+  int64_t checkCandidates();
+  // Returns the number of objects freed by the cycle.
+  uint64_t endCycle();
+  // Slides the nodes together. Called with m_lock held, between cycles.
+  void compactNodes();
+
+  void shade(uint32_t node);
+  // Frees the node of an object that is gone. It's reused once the cycle is
+  // over.
+  void freeNode(uint32_t i);
+
+  // Calls 'f' with the node of every object of the cycle that 'node'
+  // references. Returns the number of references.
+  template <typename F>
+  int forEachChild(const Node& node, F f) const;
+  // Drops the references of 'node'. Returns the number of references.
+  static int clear(const Node& node);
+
+  std::vector<Node> m_nodes;
+  // Nodes of objects that are gone, reused by track() between cycles.
+  std::vector<uint32_t> m_free;
+  // Guards m_nodes and m_free while other threads of the isolate allocate.
+  std::mutex m_lock;
+
+  // Objects tracked since the last cycle started, and how many start the
+  // next one: as many as survived the last cycle.
+  int64_t m_allocated = 0;
+  int64_t m_trigger = GC_MIN_TRIGGER;
+
+  // State of the cycle in progress. Only the nodes tracked before it
+  // started take part in it, the ones after are black.
+  Phase m_phase = Phase::idle;
+  uint32_t m_num_cycle_nodes = 0;
+  uint32_t m_cursor = 0;
+  // Identifies the cycle in the trace, see Tracer.
+  uint64_t m_trace_id = 0;
+  // References from other nodes of the cycle, per node.
+  std::vector<uint32_t> m_internal;
+  std::vector<Color> m_colors;
+  std::vector<uint32_t> m_gray;
+  // The white objects, kept alive until they are checked, and then the
+  // garbage among them until it's cleared.
+  std::vector<std::pair<uint32_t, std::shared_ptr<void>>> m_candidates;
+  // Nodes found free by the cycle.
+  std::vector<uint32_t> m_freed_nodes;
+  // Objects of the cycle that were still there when it was gathered.
+  int64_t m_num_gathered = 0;
+
+  bool m_compact_nodes = false;
+  GcStats m_stats;
+};
+
+}  // namespace Linaro
+
+#endif  // HEAP_H
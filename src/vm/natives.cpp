@@ -0,0 +1,242 @@
+#include "natives.h"
+
+#include "actor.h"
+#include "objects.h"
+#include "scheduler.h"
+#include "vm.h"
+
+namespace Linaro {
+
+static Value awaitValue(const Value& val) {
+  if (!val.isThread()) return val;
+  Thread& future = val.valueTo<Thread>();
+  Scheduler::get().join(future);
+  return future.result();
+}
+
+static void native_await(NativeCall& call) {
+  if (call.args.empty()) {
+    call.error = "await() takes a future.";
+    return;
+  }
+  call.result = awaitValue(call.args[0]);
+}
+
+static void native_wait_all(NativeCall& call) {
+  if (call.args.empty() || !call.args[0].isArray()) {
+    call.error = "wait_all() takes an array of futures.";
+    return;
+  }
+  auto results = makeObject<Array>();
+  for (const auto& [key, val] : call.args[0].valueTo<Array>().elements()) {
+    results->insert(key, awaitValue(val));
+  }
+  AllocationProfiler::allocated(results);
+  call.isolate->heap.track(results);
+  call.result = Value(results);
+}
+
+static void native_then(NativeCall& call) {
+  if (call.args.size() < 2 || !call.args[0].isThread() ||
+      !call.args[1].isClosure()) {
+    call.error = "then() takes a future and a function.";
+    return;
+  }
+  if (VM::capturesOpenVariables(call.args[1].valueTo<Closure>())) {
+    call.error =
+        "then() takes a function that captures no variables of a running "
+        "function.";
+    return;
+  }
+  auto continuation = std::make_shared<Thread>(call.args[1], call.isolate);
+  call.args[0].valueTo<Thread>().then(continuation);
+  call.result = Value(std::shared_ptr<Object>(continuation));
+}
+
+static void native_freeze(NativeCall& call) {
+  if (call.args.empty() || !call.args[0].isArray()) {
+    call.error = "freeze() takes an array.";
+    return;
+  }
+  call.args[0].valueTo<Array>().freeze();
+  call.result = call.args[0];
+}
+
+// The elements at keys 0 to size - 1, the ones the parallel natives work on.
+static std::vector<Value> elementsOf(const Array& arr) {
+  std::vector<Value> elems;
+  elems.reserve(arr.size());
+  for (int i = 0; i < arr.size(); i++) elems.push_back(arr.get((double)i));
+  return elems;
+}
+
+static Value arrayOf(Isolate& isolate, const std::vector<Value>& elems) {
+  auto arr = makeObject<Array>();
+  for (size_t i = 0; i < elems.size(); i++) arr->insert((double)i, elems[i]);
+  AllocationProfiler::allocated(arr);
+  isolate.heap.track(arr);
+  return Value(std::shared_ptr<Object>(arr));
+}
+
+static void native_pmap(NativeCall& call) {
+  if (call.args.size() < 2 || !call.args[0].isArray() ||
+      !call.args[1].isClosure()) {
+    call.error = "pmap() takes an array and a function.";
+    return;
+  }
+  std::vector<Value> elems = elementsOf(call.args[0].valueTo<Array>());
+  Closure& fn = call.args[1].valueTo<Closure>();
+  std::vector<Value> results(elems.size());
+  auto body = [&](VM& vm, int, size_t begin, size_t end) {
+    std::vector<Value> args(1);
+    for (size_t i = begin; i < end; i++) {
+      args[0] = elems[i];
+      if (vm.runFiber(fn, args, results[i]) != VMEndingStatus::VM_SUCCESS)
+        return false;
+    }
+    return true;
+  };
+  int num_chunks = Scheduler::numChunks(elems.size());
+  if (!Scheduler::runChunks(call.isolate, elems.size(), num_chunks, body)) {
+    call.error = "pmap() failed calling the function.";
+    return;
+  }
+  call.result = arrayOf(*call.isolate, results);
+}
+
+static void native_preduce(NativeCall& call) {
+  if (call.args.size() < 3 || !call.args[0].isArray() ||
+      !call.args[1].isClosure()) {
+    call.error = "preduce() takes an array, a function and an initial value.";
+    return;
+  }
+  std::vector<Value> elems = elementsOf(call.args[0].valueTo<Array>());
+  Closure& fn = call.args[1].valueTo<Closure>();
+  int num_chunks = Scheduler::numChunks(elems.size());
+  // With several chunks every chunk folds its own elements, and the initial
+  // value is folded with their results in order.
+  std::vector<Value> partials(num_chunks);
+  auto body = [&](VM& vm, int chunk, size_t begin, size_t end) {
+    std::vector<Value> args(2);
+    Value acc = num_chunks == 1 ? call.args[2] : elems[begin++];
+    for (size_t i = begin; i < end; i++) {
+      args[0] = acc;
+      args[1] = elems[i];
+      if (vm.runFiber(fn, args, acc) != VMEndingStatus::VM_SUCCESS)
+        return false;
+    }
+    partials[chunk] = acc;
+    return true;
+  };
+  if (!Scheduler::runChunks(call.isolate, elems.size(), num_chunks, body)) {
+    call.error = "preduce() failed calling the function.";
+    return;
+  }
+  if (num_chunks == 1) {
+    call.result = partials[0];
+    return;
+  }
+  VM vm(call.isolate);
+  Value acc = call.args[2];
+  std::vector<Value> args(2);
+  for (const Value& partial : partials) {
+    args[0] = acc;
+    args[1] = partial;
+    if (vm.runFiber(fn, args, acc) != VMEndingStatus::VM_SUCCESS) {
+      call.error = "preduce() failed calling the function.";
+      return;
+    }
+  }
+  call.result = acc;
+}
+
+static void native_pfilter(NativeCall& call) {
+  if (call.args.size() < 2 || !call.args[0].isArray() ||
+      !call.args[1].isClosure()) {
+    call.error = "pfilter() takes an array and a function.";
+    return;
+  }
+  std::vector<Value> elems = elementsOf(call.args[0].valueTo<Array>());
+  Closure& fn = call.args[1].valueTo<Closure>();
+  std::vector<char> keep(elems.size());
+  auto body = [&](VM& vm, int, size_t begin, size_t end) {
+    std::vector<Value> args(1);
+    Value result;
+    for (size_t i = begin; i < end; i++) {
+      args[0] = elems[i];
+      if (vm.runFiber(fn, args, result) != VMEndingStatus::VM_SUCCESS)
+        return false;
+      keep[i] = result.asBoolean();
+    }
+    return true;
+  };
+  int num_chunks = Scheduler::numChunks(elems.size());
+  if (!Scheduler::runChunks(call.isolate, elems.size(), num_chunks, body)) {
+    call.error = "pfilter() failed calling the function.";
+    return;
+  }
+  std::vector<Value> kept;
+  for (size_t i = 0; i < elems.size(); i++) {
+    if (keep[i]) kept.push_back(elems[i]);
+  }
+  call.result = arrayOf(*call.isolate, kept);
+}
+
+static const char* const NOT_AN_ACTOR = "Not running as an actor.";
+
+static void native_send(NativeCall& call) {
+  ActorSystem* actors = call.isolate->actors;
+  if (actors == nullptr) {
+    call.error = NOT_AN_ACTOR;
+    return;
+  }
+  if (call.args.size() < 2 || !call.args[0].isNumber()) {
+    call.error = "send() takes an actor and a message.";
+    return;
+  }
+  call.error =
+      actors->send(*call.isolate, (int)call.args[0].asNumber(), call.args[1]);
+}
+
+static void native_receive(NativeCall& call) {
+  ActorSystem* actors = call.isolate->actors;
+  if (actors == nullptr) {
+    call.error = NOT_AN_ACTOR;
+    return;
+  }
+  call.result = actors->receive(*call.isolate);
+}
+
+static void native_self(NativeCall& call) {
+  if (call.isolate->actors == nullptr) {
+    call.error = NOT_AN_ACTOR;
+    return;
+  }
+  call.result = Value((double)call.isolate->actor_id);
+}
+
+static void native_gc(NativeCall& call) {
+  // Fibers of the isolate may be changing the heap.
+  if (call.isolate->num_fibers > 0) {
+    call.result = Value(0.0);
+    return;
+  }
+  call.result = Value((double)call.isolate->heap.collect());
+}
+
+#define N(name) #name,
+const char* const Natives::names[]{NATIVES(N)};
+#undef N
+
+int Natives::count() { return sizeof(names) / sizeof(names[0]); }
+
+void Natives::install(std::vector<Value>& globals) {
+  CHECK(globals.size() >= (size_t)count());
+  int i = 0;
+#define N(name) \
+  globals[i++] = Value(std::make_shared<NativeFunction>(#name, native_##name));
+  NATIVES(N)
+#undef N
+}
+
+}  // namespace Linaro
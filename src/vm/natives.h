@@ -0,0 +1,53 @@
+#ifndef NATIVES_H
+#define NATIVES_H
+
+#include <vector>
+
+#include "value.h"
+
+namespace Linaro {
+
+// Built-in functions. They are declared as the first globals of every
+// script, in this order, so scripts can rebind them.
+//   await(f)          The result of future f, once it's done. Values that
+//                     aren't futures are returned as they are.
+//   wait_all(a)       An array with the results of the futures in array a,
+//                     under the same keys.
+//   then(f, callback) Calls callback with the result of future f once it's
+//                     done, without waiting for it. Returns the future of
+//                     the callback.
+//   pmap(a, f)        An array with f(x) for every element x of array a,
+//                     in order. Elements are the values at keys 0 to
+//                     size - 1. Large arrays are split into chunks that run
+//                     in parallel, so f should not change shared state.
+//   preduce(a, f, v)  Folds the elements of a into v with f(acc, x). For
+//                     large arrays chunks are folded in parallel and then
+//                     folded into v in order, so f must be associative.
+//   pfilter(a, f)     An array with the elements x of a for which f(x) is
+//                     true, in order. Parallel like pmap().
+//   freeze(a)         Makes array a, and every array in it, immutable and
+//                     returns it. Frozen arrays are sent without copying.
+//   send(actor, msg)  Sends msg to the mailbox of actor number 'actor'.
+//                     Arrays that aren't frozen are copied.
+//   receive()         The next message sent to this actor, waiting for one
+//                     if needed. Undefined once every other actor is done.
+//   self()            The number of this actor.
+//   gc()              Runs a whole cycle of the cycle collector and returns
+//                     the number of objects it freed. Does nothing while
+//                     fibers are running.
+#define NATIVES(N)                                                      \
+  N(await) N(wait_all) N(then) N(pmap) N(preduce) N(pfilter) N(freeze) \
+  N(send) N(receive) N(self) N(gc)
+
+class Natives {
+ public:
+  static const char* const names[];
+  static int count();
+
+  // Stores the built-in functions in the first globals.
+  static void install(std::vector<Value>& globals);
+};
+
+}  // namespace Linaro
+
+#endif  // NATIVES_H
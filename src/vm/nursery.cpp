@@ -0,0 +1,267 @@
+#include "nursery.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <tuple>
+#include <vector>
+
+#include "../linaro_utils/common.h"
+
+namespace Linaro {
+
+#if defined(__SANITIZE_ADDRESS__)
+
+// Leaves the objects to the sanitizer, so that it sees them.
+void* Nursery::allocate(size_t size) { return ::operator new(size); }
+void Nursery::deallocate(void* ptr, size_t) { ::operator delete(ptr); }
+void Nursery::sortFreeLists() {}
+double Nursery::fragmentation() { return 0; }
+void Nursery::beginRegion() {}
+void Nursery::endRegion(bool) {}
+
+#else
+
+static const size_t GRANULE = 16;
+static const int NUM_SIZE_CLASSES = NURSERY_MAX_OBJECT / GRANULE;
+
+static_assert(NURSERY_MAX_OBJECT % GRANULE == 0,
+              "NURSERY_MAX_OBJECT has to be a multiple of 16");
+
+struct FreeBlock {
+  FreeBlock* next;
+};
+
+struct ThreadNursery;
+
+// Blocks handed over by threads, see Nursery.
+struct Depot {
+  std::mutex lock;
+  std::vector<FreeBlock*> lists[NUM_SIZE_CLASSES];
+  // Rest of the chunks of threads that exited.
+  std::vector<std::pair<char*, char*>> chunks;
+  // Threads using the nursery, and the bytes of the ones that exited, see
+  // ThreadNursery.
+  std::vector<ThreadNursery*> threads;
+  int64_t exited_carved = 0;
+  int64_t exited_live = 0;
+};
+
+// Never destroyed, objects may be freed while the process exits.
+static Depot& depot() {
+  static Depot* depot = new Depot();
+  return *depot;
+}
+
+// Zero initialized, and trivially destructible so that objects can still be
+// freed after the thread's destructors ran.
+struct ThreadNursery {
+  char* top;
+  char* end;
+  FreeBlock* free[NUM_SIZE_CLASSES];
+  int num_free[NUM_SIZE_CLASSES];
+  // Bytes the thread has taken from chunks, and allocated minus freed.
+  // Only the thread writes them, fragmentation() reads them from any thread.
+  std::atomic<int64_t> carved;
+  std::atomic<int64_t> live;
+  bool registered;
+  // Set between beginRegion() and endRegion().
+  struct Region* region;
+};
+
+// What the thread had before its region, and the chunks of the region.
+struct Region {
+  char* top;
+  char* end;
+  FreeBlock* free[NUM_SIZE_CLASSES];
+  int num_free[NUM_SIZE_CLASSES];
+  int64_t carved;
+  int64_t live;
+  std::vector<char*> chunks;
+};
+
+static thread_local ThreadNursery t_nursery;
+
+static inline void add(std::atomic<int64_t>& counter, int64_t bytes) {
+  counter.store(counter.load(std::memory_order_relaxed) + bytes,
+                std::memory_order_relaxed);
+}
+
+// Hands the free lists and the rest of the chunk to the depot.
+struct ThreadExit {
+  bool registered = false;
+  ~ThreadExit() {
+    ThreadNursery& nursery = t_nursery;
+    Depot& shared = depot();
+    std::lock_guard<std::mutex> lock(shared.lock);
+    shared.threads.erase(
+        std::find(shared.threads.begin(), shared.threads.end(), &nursery));
+    shared.exited_carved += nursery.carved.load(std::memory_order_relaxed);
+    shared.exited_live += nursery.live.load(std::memory_order_relaxed);
+    nursery.carved = nursery.live = 0;
+    for (int c = 0; c < NUM_SIZE_CLASSES; c++) {
+      if (nursery.free[c] != nullptr) shared.lists[c].push_back(nursery.free[c]);
+      nursery.free[c] = nullptr;
+      nursery.num_free[c] = 0;
+    }
+    if (nursery.top != nursery.end)
+      shared.chunks.push_back({nursery.top, nursery.end});
+    nursery.top = nursery.end = nullptr;
+  }
+};
+
+static thread_local ThreadExit t_exit;
+
+static inline int sizeClass(size_t size) { return (size - 1) / GRANULE; }
+
+static void registerThread(ThreadNursery& nursery) {
+  t_exit.registered = true;
+  nursery.registered = true;
+  Depot& shared = depot();
+  std::lock_guard<std::mutex> lock(shared.lock);
+  shared.threads.push_back(&nursery);
+}
+
+// Fills the free list or the chunk of the thread, which are both empty for
+// class 'c'.
+static void refill(ThreadNursery& nursery, int c) {
+  if (!nursery.registered) registerThread(nursery);
+  Depot& shared = depot();
+  // Blocks of the depot outlive the region.
+  if (nursery.region == nullptr) {
+    std::lock_guard<std::mutex> lock(shared.lock);
+    if (!shared.lists[c].empty()) {
+      nursery.free[c] = shared.lists[c].back();
+      shared.lists[c].pop_back();
+      return;
+    }
+    if (!shared.chunks.empty()) {
+      std::tie(nursery.top, nursery.end) = shared.chunks.back();
+      shared.chunks.pop_back();
+      if ((size_t)(nursery.end - nursery.top) >= (c + 1) * GRANULE) return;
+    }
+  }
+  // Chunks from malloc are aligned for any object.
+  char* chunk = static_cast<char*>(std::malloc(NURSERY_CHUNK_SIZE));
+  if (chunk == nullptr) throw std::bad_alloc();
+  if (nursery.region != nullptr) nursery.region->chunks.push_back(chunk);
+  nursery.top = chunk;
+  nursery.end = chunk + NURSERY_CHUNK_SIZE;
+}
+
+void* Nursery::allocate(size_t size) {
+  if (size > (size_t)NURSERY_MAX_OBJECT) return ::operator new(size);
+  int c = sizeClass(size);
+  size_t block_size = (c + 1) * GRANULE;
+  ThreadNursery& nursery = t_nursery;
+  add(nursery.live, block_size);
+  for (;;) {
+    if (FreeBlock* block = nursery.free[c]) {
+      nursery.free[c] = block->next;
+      // Lists taken from the depot aren't counted.
+      if (nursery.num_free[c] > 0) nursery.num_free[c]--;
+      return block;
+    }
+    if ((size_t)(nursery.end - nursery.top) >= block_size) {
+      void* block = nursery.top;
+      nursery.top += block_size;
+      add(nursery.carved, block_size);
+      return block;
+    }
+    refill(nursery, c);
+  }
+}
+
+void Nursery::deallocate(void* ptr, size_t size) {
+  if (size > (size_t)NURSERY_MAX_OBJECT) {
+    ::operator delete(ptr);
+    return;
+  }
+  int c = sizeClass(size);
+  ThreadNursery& nursery = t_nursery;
+  if (!nursery.registered) registerThread(nursery);
+  add(nursery.live, -(int64_t)((c + 1) * GRANULE));
+  if (nursery.num_free[c] == NURSERY_MAX_FREE_BLOCKS &&
+      nursery.region == nullptr) {
+    Depot& shared = depot();
+    std::lock_guard<std::mutex> lock(shared.lock);
+    shared.lists[c].push_back(nursery.free[c]);
+    nursery.free[c] = nullptr;
+    nursery.num_free[c] = 0;
+  }
+  FreeBlock* block = static_cast<FreeBlock*>(ptr);
+  block->next = nursery.free[c];
+  nursery.free[c] = block;
+  nursery.num_free[c]++;
+}
+
+void Nursery::sortFreeLists() {
+  ThreadNursery& nursery = t_nursery;
+  std::vector<FreeBlock*> blocks;
+  for (int c = 0; c < NUM_SIZE_CLASSES; c++) {
+    blocks.clear();
+    for (FreeBlock* block = nursery.free[c]; block; block = block->next)
+      blocks.push_back(block);
+    std::sort(blocks.begin(), blocks.end());
+    FreeBlock* head = nullptr;
+    for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+      (*it)->next = head;
+      head = *it;
+    }
+    nursery.free[c] = head;
+  }
+}
+
+void Nursery::beginRegion() {
+  ThreadNursery& nursery = t_nursery;
+  CHECK(nursery.region == nullptr);
+  Region* region = new Region();
+  region->top = nursery.top;
+  region->end = nursery.end;
+  std::copy(nursery.free, nursery.free + NUM_SIZE_CLASSES, region->free);
+  std::copy(nursery.num_free, nursery.num_free + NUM_SIZE_CLASSES,
+            region->num_free);
+  region->carved = nursery.carved.load(std::memory_order_relaxed);
+  region->live = nursery.live.load(std::memory_order_relaxed);
+  nursery.top = nursery.end = nullptr;
+  std::fill(nursery.free, nursery.free + NUM_SIZE_CLASSES, nullptr);
+  std::fill(nursery.num_free, nursery.num_free + NUM_SIZE_CLASSES, 0);
+  nursery.region = region;
+}
+
+void Nursery::endRegion(bool release) {
+  ThreadNursery& nursery = t_nursery;
+  Region* region = nursery.region;
+  CHECK(region != nullptr);
+  if (release) {
+    for (char* chunk : region->chunks) std::free(chunk);
+  }
+  // Blocks of objects from before the region, freed during it, are lost.
+  nursery.top = region->top;
+  nursery.end = region->end;
+  std::copy(region->free, region->free + NUM_SIZE_CLASSES, nursery.free);
+  std::copy(region->num_free, region->num_free + NUM_SIZE_CLASSES,
+            nursery.num_free);
+  nursery.carved.store(region->carved, std::memory_order_relaxed);
+  nursery.live.store(region->live, std::memory_order_relaxed);
+  nursery.region = nullptr;
+  delete region;
+}
+
+double Nursery::fragmentation() {
+  Depot& shared = depot();
+  std::lock_guard<std::mutex> lock(shared.lock);
+  int64_t carved = shared.exited_carved;
+  int64_t live = shared.exited_live;
+  for (ThreadNursery* nursery : shared.threads) {
+    carved += nursery->carved.load(std::memory_order_relaxed);
+    live += nursery->live.load(std::memory_order_relaxed);
+  }
+  return carved == 0 ? 0 : (double)(carved - live) / carved;
+}
+
+#endif
+
+}  // namespace Linaro
@@ -0,0 +1,76 @@
+#ifndef NURSERY_H
+#define NURSERY_H
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace Linaro {
+
+// Allocates the small objects the VM keeps creating and dropping (strings,
+// arrays, closures, captured variables), together with their reference
+// counts. Every thread bumps a pointer through a chunk of its own, and the
+// block of a freed object goes to a free list per size class of the thread
+// that frees it, which reuses it first. Neither takes a lock.
+//
+// Free lists that grow past NURSERY_MAX_FREE_BLOCKS, and the ones of threads
+// that exit, are handed to a shared depot that threads fill up from before
+// they take a new chunk, so memory freed by some other thread than the one
+// that allocated it comes back. Chunks are never given back.
+class Nursery {
+ public:
+  static void* allocate(size_t size);
+  static void deallocate(void* ptr, size_t size);
+
+  // Sorts the free lists of the calling thread by address, so that the
+  // objects it allocates next are packed together.
+  static void sortFreeLists();
+
+  // Until endRegion(), the calling thread allocates from chunks of the
+  // region only, and doesn't hand blocks to other threads. endRegion(true)
+  // then frees the chunks at once, without destroying the objects in them:
+  // nothing may use or free them any more, and the memory they own outside
+  // the nursery is leaked. With 'release' false the chunks are kept, for when
+  // other threads may still hold blocks of the region.
+  static void beginRegion();
+  static void endRegion(bool release);
+
+  // Share of the bytes handed out from chunks (by all threads) that are
+  // free now, from 0 to 1.
+  static double fragmentation();
+};
+
+// Standard allocator over the nursery, for std::allocate_shared.
+template <typename T>
+struct NurseryAllocator {
+  using value_type = T;
+
+  NurseryAllocator() = default;
+  template <typename U>
+  NurseryAllocator(const NurseryAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(Nursery::allocate(n * sizeof(T)));
+  }
+  void deallocate(T* ptr, size_t n) { Nursery::deallocate(ptr, n * sizeof(T)); }
+
+  template <typename U>
+  bool operator==(const NurseryAllocator<U>&) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const NurseryAllocator<U>&) const {
+    return false;
+  }
+};
+
+// std::make_shared for objects allocated in the nursery.
+template <typename T, typename... Args>
+inline std::shared_ptr<T> makeObject(Args&&... args) {
+  return std::allocate_shared<T>(NurseryAllocator<T>(),
+                                 std::forward<Args>(args)...);
+}
+
+}  // namespace Linaro
+
+#endif  // NURSERY_H
@@ -2,6 +2,7 @@
 
 #include "../ast/expression.h"
 #include "../ast/statement.h"
+#include "scheduler.h"
 #include "value.h"
 
 namespace Linaro {
@@ -20,7 +21,7 @@ bool String::canBeNumber() const {
 }
 
 double String::asNumber() const {
-  double temp;
+  double temp = 0;
   try {
     temp = std::stod(m_str);
   } catch (const std::invalid_argument& err) {
@@ -42,6 +43,26 @@ int Function::addCapturedVariable(int index, bool is_local) {
   return m_num_captured_variables++;
 }
 
+/* FunctionProfile */
+
+bool FunctionProfile::recordCall(uint32_t offset, Function* callee) {
+  CallSiteFeedback& feedback = call_site_feedback[offset];
+  if (feedback.is_polymorphic) return false;
+  if (feedback.callee != callee) {
+    if (feedback.callee != nullptr) {
+      feedback.is_polymorphic = true;
+      return false;
+    }
+    feedback.callee = callee;
+  }
+  return ++feedback.count % INLINE_CALL_THRESHOLD == 0;
+}
+
+CallSiteFeedback* FunctionProfile::getCallSiteFeedback(uint32_t offset) {
+  auto it = call_site_feedback.find(offset);
+  return it == call_site_feedback.end() ? nullptr : &it->second;
+}
+
 #ifdef DEBUG
 void Function::printCapturedVariables() const {
   std::cout << "Captured variables:\n";
@@ -53,7 +74,8 @@ void Function::printCapturedVariables() const {
 
 void Function::printFunction() {
   std::cout << "fn " << m_name << "(";
-  printArguments(m_fn_ast->args());
+  // Functions the code generator makes up have no AST.
+  if (m_fn_ast != nullptr) printArguments(m_fn_ast->args());
   std::cout << "):\n";
   std::cout << "Num arguments: " << m_num_args
             << "\nNum locals: " << m_num_locals
@@ -81,7 +103,8 @@ void Function::printConstants() {
     if (val.isFunction()) {
       Function& fn = val.valueTo<Function>();
       std::cout << "fn " << val << "(";
-      printArguments(fn.getFunctionAST()->args());
+      if (fn.getFunctionAST() != nullptr)
+        printArguments(fn.getFunctionAST()->args());
       std::cout << ")\n";
     } else {
       std::cout << val << '\n';
@@ -96,33 +119,118 @@ void Function::printConstants() {
 // Array::Array(std::initializer_list<Value> list)
 //   : m_values{list.begin(), list.end()} {}
 
+std::recursive_mutex& Array::lockOf(const Array* arr) {
+  // Never destroyed, workers may still run while the process exits.
+  static auto* locks = new std::recursive_mutex[ARRAY_LOCK_STRIPES];
+  return locks[(reinterpret_cast<uintptr_t>(arr) / sizeof(Array)) %
+               ARRAY_LOCK_STRIPES];
+}
+
+std::vector<std::pair<Value, Value>> Array::elements() const {
+  Guard guard(this);
+  return {m_values.begin(), m_values.end()};
+}
+
 // Using this impl for now:
 size_t Array::hash() const {
-  size_t seed = m_values.size();
+  // Elements that are arrays are hashed without holding the lock.
+  std::vector<std::pair<Value, Value>> elems = elements();
+  size_t seed = elems.size();
   if (seed > 1) {
-    for (auto& i : m_values) {
+    for (auto& i : elems) {
       seed ^= i.second.hash() + 0x9e3779b9 + (seed << 6) + (seed >> 2);
     }
     return seed;
   }
-  return const_cast<Array*>(this)->get(0.0).hash();
+  return get(0.0).hash();
 }
 
-double Array::asNumber() const {
-  return const_cast<Array*>(this)->get(0.0).asNumber();
+double Array::asNumber() const { return get(0.0).asNumber(); }
+bool Array::asBoolean() const { return get(0.0).asBoolean(); }
+
+void Array::freeze() {
+  std::vector<Array*> frozen;
+  bool shareable = true;
+  freeze(frozen, shareable);
+  // Conservative for arrays that only reach the unshareable values.
+  for (Array* arr : frozen) arr->m_shareable = shareable;
 }
-bool Array::asBoolean() const {
-  return const_cast<Array*>(this)->get(0.0).asBoolean();
+
+void Array::freeze(std::vector<Array*>& frozen, bool& shareable) {
+  {
+    Guard guard(this);
+    if (m_frozen) {
+      shareable = shareable && m_shareable;
+      return;
+    }
+    m_frozen = true;
+  }
+  frozen.push_back(this);
+  for (const auto& [key, val] : elements()) {
+    for (const Value* v : {&key, &val}) {
+      if (v->isArray())
+        v->valueTo<Array>().freeze(frozen, shareable);
+      else if (v->isObject() && !v->isString())
+        shareable = false;
+    }
+  }
 }
 
 std::string Array::asString() const {
   std::string res;
-  for (const auto& v : m_values) {
+  for (const auto& v : elements()) {
     res = res + v.second.asString();  //+ delimiter;
   }
   return res;
 }
 
-/* Thread (TODO) */
+/* Thread */
+
+bool Thread::tryStart() {
+  uint8_t expected = ready;
+  return m_state.compare_exchange_strong(expected, running,
+                                         std::memory_order_acquire);
+}
+
+void Thread::then(std::shared_ptr<Thread> continuation) {
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!isDone()) {
+      m_continuations.push_back(std::move(continuation));
+      return;
+    }
+  }
+  continuation->m_args = {m_result};
+  continuation->m_state = ready;
+  Scheduler::get().spawn(std::move(continuation));
+}
+
+void Thread::finish(const Value& result) {
+  // The result is published by the store to m_state, so joiners on other
+  // OS threads see all of it.
+  m_result = result;
+  // The fiber doesn't need them any more, don't keep them alive with the
+  // handle. The handle may be stored in the globals, too.
+  m_args.clear();
+  m_task = nullptr;
+  m_isolate = nullptr;
+  std::vector<std::shared_ptr<Thread>> continuations;
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_state.store(done, std::memory_order_release);
+    continuations.swap(m_continuations);
+  }
+  m_done.notify_all();
+  for (auto& continuation : continuations) {
+    continuation->m_args = {m_result};
+    continuation->m_state = ready;
+    Scheduler::get().spawn(std::move(continuation));
+  }
+}
+
+void Thread::wait() {
+  std::unique_lock<std::mutex> lock(m_lock);
+  m_done.wait(lock, [this] { return isDone(); });
+}
 
 }  // namespace Linaro
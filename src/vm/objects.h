@@ -1,11 +1,17 @@
 #ifndef OBJECT_H
 #define OBJECT_H
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 #include "../code_generator/chunk.h"
+#include "nursery.h"
 #include "value.h"
 
 namespace Linaro {
@@ -13,10 +19,13 @@ namespace Linaro {
 class String : public Object {
  public:
   explicit String(std::string_view str) : Object{nString}, m_str{str} {}
+  explicit String(std::string&& str) : Object{nString}, m_str{std::move(str)} {}
   bool canBeNumber() const override;
   double asNumber() const override;
   bool asBoolean() const override { return !m_str.empty(); }
   std::string asString() const override { return m_str; }
+  // Without copying it.
+  const std::string& str() const { return m_str; }
   size_t hash() const override { return std::hash<std::string>{}(m_str); }
 
  private:
@@ -33,7 +42,47 @@ struct CompilerCapturedVariable {
   bool is_local;
 };
 
+class Function;
+
+// What the VM has observed at a single call_tos in baseline code.
+struct CallSiteFeedback {
+  // The only function called from this site so far.
+  Function* callee = nullptr;
+  uint32_t count = 0;
+  // More than one function has been called from this site.
+  bool is_polymorphic = false;
+};
+
 class FunctionLiteral;  // Function AST node
+struct OptimizedCode;   // See inliner.h
+struct Isolate;         // See program.h
+
+// What an isolate has observed while running a function in baseline code,
+// and what it has optimized the function to. Compiled functions are shared
+// by every isolate running the program, so this is kept per isolate, see
+// Isolate.
+struct FunctionProfile {
+  // Call site feedback, keyed by the offset of the call_tos in the code of
+  // the function. Returns true every INLINE_CALL_THRESHOLD calls of a site
+  // with a stable callee, so sites whose callee wasn't inlinable yet are
+  // reconsidered.
+  bool recordCall(uint32_t offset, Function* callee);
+  CallSiteFeedback* getCallSiteFeedback(uint32_t offset);
+
+  // Back-edge counters of the loops of the function, indexed by the second
+  // operand of jmp_loop. Returns true every OSR_BACK_EDGE_THRESHOLD
+  // iterations.
+  bool recordBackEdge(int loop) {
+    return ++loop_counters[loop] % OSR_BACK_EDGE_THRESHOLD == 0;
+  }
+
+  std::unordered_map<uint32_t, CallSiteFeedback> call_site_feedback;
+  bool has_hot_call_sites = false;
+  std::vector<uint32_t> loop_counters;
+  // Code produced by the inliner. Frames that are already running the
+  // optimized code keep it alive after it has been invalidated.
+  std::shared_ptr<OptimizedCode> optimized_code;
+};
 
 #ifdef DEBUG
 class Identifier;
@@ -76,6 +125,14 @@ class Function : public Object {
     return &m_captured_variables[i];
   }
 
+  // Index of the function in its program, see Program::functions().
+  int id() const { return m_id; }
+  void setId(int id) { m_id = id; }
+
+  // Loops are numbered by the second operand of jmp_loop.
+  int addLoop() { return m_num_loops++; }
+  int numLoops() const { return m_num_loops; }
+
 #ifdef DEBUG
   void printCapturedVariables() const;
   void printFunction();
@@ -91,16 +148,20 @@ class Function : public Object {
   bool m_is_compiled = false;  // for lazy compilation
   int m_num_args;
   int m_num_locals;
-  int m_num_captured_variables;
+  int m_num_captured_variables = 0;
   BytecodeChunk m_code;
 
   // Constants used in this function
   std::vector<Value> m_constants;
 
   std::vector<CompilerCapturedVariable> m_captured_variables;
+
+  int m_id = 0;
+  int m_num_loops = 0;
 };
 
 struct CapturedVariable;
+class VM;
 class Closure : public Object {
  public:
   Closure(Function* fn) : Object(nClosure), m_fn{fn} {}
@@ -108,36 +169,121 @@ class Closure : public Object {
   size_t hash() const override { return m_fn->hash(); }
 
   Function* fun() const { return m_fn; }
-  std::vector<CapturedVariable*>& getCapturedVariables() {
+  std::vector<std::shared_ptr<CapturedVariable>>& getCapturedVariables() {
     return m_captured_variables;
   }
 
-  void addCapturedVariable(CapturedVariable* cv) {
-    m_captured_variables.push_back(cv);
+  void addCapturedVariable(std::shared_ptr<CapturedVariable> cv) {
+    m_captured_variables.push_back(std::move(cv));
   }
 
   CapturedVariable* getCapturedVariable(int x) {
-    return m_captured_variables[x];
+    return m_captured_variables[x].get();
   }
 
  private:
   // The function this closure is an instance of
   Function* m_fn;
 
-  // Variables captured from outer functions
-  // The captured variables will exist in a linked list of all
-  // captured variables in the VM. (later in one per thread).
-  std::vector<CapturedVariable*> m_captured_variables;
+  // Variables captured from outer functions. Shared with the other closures
+  // that captured them, and they may outlive the VM that created them when
+  // the closure is passed out of a fiber.
+  std::vector<std::shared_ptr<CapturedVariable>> m_captured_variables;
 };
 
-// This class will basically be what VM is now
+// A fiber, the handle returned by f&(args). It runs the call on a VM of its
+// own, so it has its own operand stack, call stack and open captured
+// variables. Fibers share the isolate of the script that spawned them. See
+// scheduler.h for how they are run.
 class Thread : public Object {
-  Thread() : Object{nThread} {}
+ public:
+  Thread(const Value& closure, std::vector<Value> args,
+         std::shared_ptr<Isolate> isolate)
+      : Object{nThread},
+        m_closure{closure},
+        m_args{std::move(args)},
+        m_isolate{std::move(isolate)} {}
+  // A continuation of some other fiber, see then().
+  Thread(const Value& closure, std::shared_ptr<Isolate> isolate)
+      : Thread{closure, {}, std::move(isolate)} {
+    m_state = waiting;
+  }
+  // A fiber running native code instead of a closure, like a chunk of
+  // pmap(). It's handed the VM of the fiber to call closures on.
+  using Task = std::function<Value(VM& vm)>;
+  Thread(Task task, std::shared_ptr<Isolate> isolate)
+      : Object{nThread},
+        m_task{std::move(task)},
+        m_isolate{std::move(isolate)} {}
   bool canBeNumber() const override { return false; }
   double asNumber() const override { return 0; }
-  bool asBoolean() const override { return false; }
-  std::string asString() const override { return "placeholder"; }
-  size_t hash() const override { return 0; }
+  bool asBoolean() const override { return true; }
+  std::string asString() const override {
+    return "<fiber " + m_closure.asString() + ">";
+  }
+  size_t hash() const override { return std::hash<const Thread*>{}(this); }
+
+  Closure& closure() const { return m_closure.valueTo<Closure>(); }
+  const Task& task() const { return m_task; }
+  const std::vector<Value>& arguments() const { return m_args; }
+  // Only set until the fiber is done.
+  const std::shared_ptr<Isolate>& isolate() const { return m_isolate; }
+
+  // Claims the fiber for running. Returns true for exactly one caller, once
+  // the fiber can run.
+  bool tryStart();
+  // Spawns 'continuation' with the result of this fiber as its argument once
+  // this fiber is done. 'continuation' must not have been spawned.
+  void then(std::shared_ptr<Thread> continuation);
+  // Publishes the return value of the fiber and wakes up its joiners.
+  void finish(const Value& result);
+  bool isDone() const { return m_state.load(std::memory_order_acquire) == done; }
+  // Blocks until the fiber is done.
+  void wait();
+  // Only valid once the fiber is done.
+  const Value& result() const { return m_result; }
+
+ private:
+  // A continuation is waiting until the fiber it continues is done.
+  enum State : uint8_t { waiting, ready, running, done };
+
+  Value m_closure;
+  std::vector<Value> m_args;
+  Task m_task;
+  std::shared_ptr<Isolate> m_isolate;
+  Value m_result;
+
+  std::atomic<uint8_t> m_state{ready};
+  std::mutex m_lock;
+  std::condition_variable m_done;
+  // Guarded by m_lock.
+  std::vector<std::shared_ptr<Thread>> m_continuations;
+};
+
+// What a built-in function is called with. Set 'error' to fail the call
+// with a runtime error.
+struct NativeCall {
+  std::vector<Value> args;
+  // Isolate of the caller, for the fibers the function spawns.
+  std::shared_ptr<Isolate> isolate;
+  Value result;
+  const char* error = nullptr;
+};
+
+// A built-in function, see natives.h.
+class NativeFunction : public Object {
+ public:
+  using Code = void (*)(NativeCall& call);
+  NativeFunction(const char* name, Code code)
+      : Object{nNativeFunction}, m_name{name}, m_code{code} {}
+  std::string asString() const override { return m_name; }
+  size_t hash() const override { return std::hash<const char*>{}(m_name); }
+
+  void call(NativeCall& call) const { m_code(call); }
+
+ private:
+  const char* m_name;
+  Code m_code;
 };
 
 class Array : public Object {
@@ -145,12 +291,41 @@ class Array : public Object {
   // Array(std::initializer_list<Value> list);
   Array() : Object{nArray} {}
 
-  inline Value& get(const Value& v) { return m_values[v]; }
+  // Once fibers run, arrays may be used from several threads at once, and
+  // every access locks the array. Set when the first fiber is spawned.
+  static void setShared() { s_shared.store(true, std::memory_order_relaxed); }
+
+  // Reading never changes the array, so frozen arrays can be read from
+  // several threads.
+  inline Value get(const Value& v) const {
+    Guard guard(this);
+    auto it = m_values.find(v);
+    return it == m_values.end() ? Value() : it->second;
+  }
   inline void insert(const Value& key, const Value& val) {
+    Guard guard(this);
+    CHECK(!m_frozen);
     m_values.insert({key, val});
   }
 
-  int size() const { return m_values.size(); }
+  // A frozen array, and every array in it, can't be changed any more. It's
+  // shared instead of copied when it's sent to another isolate, unless it
+  // holds values that are tied to an isolate, like closures.
+  void freeze();
+  bool isFrozen() const { return m_frozen; }
+  bool isShareable() const { return m_frozen && m_shareable; }
+
+  // Drops the elements, see Heap.
+  void clear() { m_values.clear(); }
+
+  int size() const {
+    Guard guard(this);
+    return m_values.size();
+  }
+  // A copy of the keys and elements, for walking an array that fibers may
+  // change meanwhile.
+  std::vector<std::pair<Value, Value>> elements() const;
+  // Only while no fibers run, see elements().
   const auto& getArray() const { return m_values; }
   void setDelimiter(char c) { delimiter = c; }
 
@@ -161,9 +336,33 @@ class Array : public Object {
   size_t hash() const override;
 
  private:
+  // Holds the lock of an array while fibers run. The locks are striped by
+  // the address of the array, and recursive since looking up an array key
+  // hashes and compares that array.
+  class Guard {
+   public:
+    explicit Guard(const Array* arr)
+        : m_lock{s_shared.load(std::memory_order_relaxed) ? &lockOf(arr)
+                                                          : nullptr} {
+      if (m_lock != nullptr) m_lock->lock();
+    }
+    ~Guard() {
+      if (m_lock != nullptr) m_lock->unlock();
+    }
+
+   private:
+    std::recursive_mutex* m_lock;
+  };
+  static std::recursive_mutex& lockOf(const Array* arr);
+  static inline std::atomic<bool> s_shared{false};
+
   // std::vector<Value> m_values;
   std::unordered_map<Value, Value, Value::ValueHasher> m_values;
+  void freeze(std::vector<Array*>& frozen, bool& shareable);
+
   char delimiter = ' ';
+  bool m_frozen = false;
+  bool m_shareable = false;
 };
 
 }  // namespace Linaro
@@ -0,0 +1,162 @@
+#include "opcode_stats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../linaro_utils/common.h"
+
+namespace Linaro {
+
+namespace {
+
+// Counts of the VMs flushed so far.
+struct Totals {
+  std::mutex lock;
+  uint64_t singles[Bytecode::NUM_BYTECODES] = {};
+  std::unordered_map<uint32_t, uint64_t> pairs;
+  std::unordered_map<uint32_t, uint64_t> triples;
+  std::unordered_map<uint32_t, uint64_t> operands;
+  bool print = false;
+  std::string json_file;
+};
+
+struct Row {
+  // Opcodes of the sequence, or an opcode and its operand.
+  std::vector<int> ops;
+  int operand;
+  uint64_t count;
+};
+
+}  // namespace
+
+static Totals &totals() {
+  static Totals totals;
+  return totals;
+}
+
+void OpcodeStats::flush() {
+  Totals &all = totals();
+  std::lock_guard<std::mutex> lock(all.lock);
+  for (int op = 0; op < Bytecode::NUM_BYTECODES; op++) {
+    all.singles[op] += m_singles[op];
+    m_singles[op] = 0;
+    for (int next = 0; next < Bytecode::NUM_BYTECODES; next++) {
+      uint64_t &count = m_pairs[op * Bytecode::NUM_BYTECODES + next];
+      if (count == 0) continue;
+      all.pairs[key(op, next)] += count;
+      count = 0;
+    }
+  }
+  for (const auto &[key, count] : m_triples) all.triples[key] += count;
+  for (const auto &[key, count] : m_operands) all.operands[key] += count;
+  m_triples.clear();
+  m_operands.clear();
+  m_length = 0;
+}
+
+void OpcodeStats::enable(bool print, const char *json_file) {
+  Totals &all = totals();
+  all.print = print;
+  if (json_file != nullptr) all.json_file = json_file;
+  s_enabled = print || json_file != nullptr;
+}
+
+// Rows of 'counts', most frequent first. 'length' is the number of opcodes
+// in a key, 0 if it's an opcode and an operand.
+static std::vector<Row> sortRows(
+    const std::unordered_map<uint32_t, uint64_t> &counts, int length) {
+  std::vector<Row> rows;
+  for (const auto &[key, count] : counts) {
+    Row row{{(int)(key >> 24)}, -1, count};
+    if (length == 0) {
+      row.operand = (key >> 8) & 0xffff;
+    } else {
+      if (length >= 2) row.ops.push_back((key >> 8) & 0xff);
+      if (length == 3) row.ops.push_back(key & 0xff);
+    }
+    rows.push_back(std::move(row));
+  }
+  std::sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+    if (a.count != b.count) return a.count > b.count;
+    return a.ops != b.ops ? a.ops < b.ops : a.operand < b.operand;
+  });
+  return rows;
+}
+
+static std::string rowName(const Row &row) {
+  std::string name;
+  for (int op : row.ops) {
+    if (!name.empty()) name += ' ';
+    name += bytecode_to_string[op];
+  }
+  if (row.operand >= 0) name += " " + std::to_string(row.operand);
+  return name;
+}
+
+static void printRows(FILE *out, const char *title,
+                      const std::vector<Row> &rows, uint64_t total) {
+  fprintf(out, "\n%-40s %14s %7s\n", title, "count", "%");
+  int printed = 0;
+  for (const Row &row : rows) {
+    if (printed++ == PROFILE_REPORT_ROWS) break;
+    fprintf(out, "%-40s %14llu %6.2f%%\n", rowName(row).c_str(),
+            (unsigned long long)row.count,
+            total == 0 ? 0.0 : 100.0 * row.count / total);
+  }
+}
+
+static void writeRows(FILE *out, const char *key, const std::vector<Row> &rows,
+                      bool last) {
+  fprintf(out, "  \"%s\": [", key);
+  for (size_t i = 0; i < rows.size(); i++) {
+    fprintf(out, "%s\n    {\"ops\": [", i == 0 ? "" : ",");
+    for (size_t k = 0; k < rows[i].ops.size(); k++) {
+      fprintf(out, "%s\"%s\"", k == 0 ? "" : ", ",
+              bytecode_to_string[rows[i].ops[k]]);
+    }
+    fprintf(out, "]");
+    if (rows[i].operand >= 0)
+      fprintf(out, ", \"operand\": %d", rows[i].operand);
+    fprintf(out, ", \"count\": %llu}", (unsigned long long)rows[i].count);
+  }
+  fprintf(out, "\n  ]%s\n", last ? "" : ",");
+}
+
+void OpcodeStats::report() {
+  Totals &all = totals();
+  std::lock_guard<std::mutex> lock(all.lock);
+  std::unordered_map<uint32_t, uint64_t> singles;
+  uint64_t total = 0;
+  for (int op = 0; op < Bytecode::NUM_BYTECODES; op++) {
+    if (all.singles[op] == 0) continue;
+    singles[key(op, 0)] = all.singles[op];
+    total += all.singles[op];
+  }
+  std::vector<Row> rows[] = {
+      sortRows(singles, 1), sortRows(all.pairs, 2), sortRows(all.triples, 3),
+      sortRows(all.operands, 0)};
+  const char *titles[] = {"opcode", "pair", "triple", "operand"};
+  const char *keys[] = {"opcodes", "pairs", "triples", "operands"};
+
+  if (all.print) {
+    fprintf(stderr, "\n---- OPCODE STATS ----\n\n");
+    fprintf(stderr, "%llu instructions\n", (unsigned long long)total);
+    for (int i = 0; i < 4; i++) printRows(stderr, titles[i], rows[i], total);
+  }
+  if (!all.json_file.empty()) {
+    FILE *out = fopen(all.json_file.c_str(), "w");
+    if (out == nullptr) {
+      fprintf(stderr, "Failed to write %s\n", all.json_file.c_str());
+      return;
+    }
+    fprintf(out, "{\n  \"instructions\": %llu,\n", (unsigned long long)total);
+    for (int i = 0; i < 4; i++) writeRows(out, keys[i], rows[i], i == 3);
+    fprintf(out, "}\n");
+    fclose(out);
+  }
+}
+
+}  // namespace Linaro
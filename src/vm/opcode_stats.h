@@ -0,0 +1,76 @@
+#ifndef OPCODE_STATS_H
+#define OPCODE_STATS_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "../code_generator/chunk.h"
+
+namespace Linaro {
+
+// Counts how often every opcode, pair and triple of opcodes is executed, and
+// every operand of load, constant and gload, for the VM it belongs to. The
+// candidates for superinstructions.
+//
+// Pairs and triples are only counted for instructions that follow each
+// other in the code as well, the ones a fused instruction could replace: a
+// taken jump, a call or a return starts a new sequence.
+//
+// Only used when built with LINARO_PROFILE, the VM doesn't call it otherwise.
+class OpcodeStats {
+ public:
+  // Called when the instruction at 'offset' of 'code' is dispatched.
+  inline void instruction(const BytecodeChunk *code, uint32_t offset,
+                          Bytecode op) {
+    if (code != m_code || offset != m_next) m_length = 0;
+    m_code = code;
+    m_next = offset + BytecodeChunk::instructionSize(op);
+    m_singles[op]++;
+    if (m_length >= 1) m_pairs[m_last * Bytecode::NUM_BYTECODES + op]++;
+    if (m_length >= 2) m_triples[key(m_before_last, m_last, op)]++;
+    m_before_last = m_last;
+    m_last = op;
+    m_length++;
+    if (op == Bytecode::load || op == Bytecode::constant ||
+        op == Bytecode::gload)
+      m_operands[key(op, code->read16Bits(offset + 1))]++;
+  }
+
+  // Adds the counts to the ones of the process and clears them.
+  void flush();
+
+  // Enables printing the tables of the process at exit, with
+  // '--opcode-stats', and writing them as JSON to 'json_file', with
+  // '--opcode-stats-json'.
+  static void enable(bool print, const char *json_file);
+  static inline bool enabled() { return s_enabled; }
+  // Prints what enable() asked for.
+  static void report();
+
+  // Packs a sequence of up to three opcodes, or an opcode and its operand.
+  static inline uint32_t key(uint32_t a, uint32_t b, uint32_t c = 0) {
+    return a << 24 | b << 8 | c;
+  }
+
+ private:
+  static inline bool s_enabled = false;
+
+  // The last instructions of the sequence running.
+  const BytecodeChunk *m_code = nullptr;
+  uint32_t m_next = 0;
+  int m_length = 0;
+  Bytecode m_last = Bytecode::nop;
+  Bytecode m_before_last = Bytecode::nop;
+
+  uint64_t m_singles[Bytecode::NUM_BYTECODES] = {};
+  // On the heap, VMs of fibers live on the stacks of the workers.
+  std::vector<uint64_t> m_pairs =
+      std::vector<uint64_t>(Bytecode::NUM_BYTECODES * Bytecode::NUM_BYTECODES);
+  std::unordered_map<uint32_t, uint64_t> m_triples;
+  std::unordered_map<uint32_t, uint64_t> m_operands;
+};
+
+}  // namespace Linaro
+
+#endif  // OPCODE_STATS_H
@@ -0,0 +1,158 @@
+#include "perf_counters.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "objects.h"
+
+namespace Linaro {
+
+namespace {
+
+struct Calls {
+  std::mutex lock;
+  // Number of calls and the counters of all of them, per function.
+  std::map<std::string, std::pair<uint64_t, PerfCounters::Sample>> functions;
+};
+
+}  // namespace
+
+static int s_fds[PerfCounters::NUM_EVENTS] = {-1, -1, -1, -1, -1};
+
+static Calls& calls() {
+  static Calls calls;
+  return calls;
+}
+
+static void describe(PerfCounters::Event event, perf_event_attr& attr) {
+  auto cache = [](uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  };
+  switch (event) {
+    case PerfCounters::cycles:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case PerfCounters::instructions:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case PerfCounters::branch_misses:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    case PerfCounters::l1d_misses:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = cache(PERF_COUNT_HW_CACHE_L1D);
+      break;
+    case PerfCounters::llc_misses:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = cache(PERF_COUNT_HW_CACHE_LL);
+      break;
+    default:
+      break;
+  }
+}
+
+bool PerfCounters::open(std::string& error) {
+  for (int event = 0; event < NUM_EVENTS; event++) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    describe(static_cast<Event>(event), attr);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    s_fds[event] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (s_fds[event] < 0 && error.empty()) error = strerror(errno);
+    s_open = s_open || s_fds[event] >= 0;
+  }
+  return s_open;
+}
+
+bool PerfCounters::available(Event event) { return s_fds[event] >= 0; }
+
+const char* PerfCounters::name(Event event) {
+#define T(name) #name,
+  static const char* const names[] = {PERF_EVENTS(T)};
+#undef T
+  return names[event];
+}
+
+PerfCounters::Sample PerfCounters::read() {
+  Sample sample;
+  for (int event = 0; event < NUM_EVENTS; event++) {
+    // Value, time enabled, time running.
+    uint64_t values[3];
+    if (s_fds[event] < 0 ||
+        ::read(s_fds[event], values, sizeof(values)) != sizeof(values))
+      continue;
+    sample.values[event] =
+        values[2] == 0 || values[2] == values[1]
+            ? values[0]
+            : (uint64_t)((double)values[0] * values[1] / values[2]);
+  }
+  return sample;
+}
+
+PerfCounters::Sample& PerfCounters::Sample::operator+=(const Sample& other) {
+  for (int event = 0; event < NUM_EVENTS; event++) {
+    values[event] += other.values[event];
+  }
+  return *this;
+}
+
+PerfCounters::Sample PerfCounters::Sample::operator-(
+    const Sample& other) const {
+  Sample diff;
+  for (int event = 0; event < NUM_EVENTS; event++) {
+    diff.values[event] = values[event] - other.values[event];
+  }
+  return diff;
+}
+
+void PerfCounters::addCall(const Function* fn, const Sample& start) {
+  Sample delta = read() - start;
+  Calls& all = calls();
+  std::lock_guard<std::mutex> lock(all.lock);
+  auto& call = all.functions[std::string(fn->name())];
+  call.first++;
+  call.second += delta;
+}
+
+void PerfCounters::printCalls(FILE* out) {
+  Calls& all = calls();
+  std::lock_guard<std::mutex> lock(all.lock);
+  std::vector<std::pair<std::string, std::pair<uint64_t, Sample>>> rows(
+      all.functions.begin(), all.functions.end());
+  std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {
+    return a.second.second.values[cycles] > b.second.second.values[cycles];
+  });
+  fprintf(out, "\n%-24s %10s", "top-level call", "calls");
+  for (int event = 0; event < NUM_EVENTS; event++) {
+    fprintf(out, " %14s", name(static_cast<Event>(event)));
+  }
+  fprintf(out, "\n");
+  for (const auto& [fn, call] : rows) {
+    fprintf(out, "%-24s %10llu", fn.c_str(), (unsigned long long)call.first);
+    for (int event = 0; event < NUM_EVENTS; event++) {
+      if (available(static_cast<Event>(event)))
+        fprintf(out, " %14llu", (unsigned long long)call.second.values[event]);
+      else
+        fprintf(out, " %14s", "n/a");
+    }
+    fprintf(out, "\n");
+  }
+}
+
+}  // namespace Linaro
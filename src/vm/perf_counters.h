@@ -0,0 +1,58 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace Linaro {
+
+class Function;
+
+#define PERF_EVENTS(T) \
+  T(cycles)            \
+  T(instructions)      \
+  T(branch_misses)     \
+  T(l1d_misses)        \
+  T(llc_misses)
+
+// Hardware counters of the thread that opened them, from perf_event_open.
+// Events the kernel or the container doesn't allow are left out, and read
+// as 0.
+class PerfCounters {
+ public:
+#define T(name) name,
+  enum Event : uint8_t { PERF_EVENTS(T) NUM_EVENTS };
+#undef T
+
+  struct Sample {
+    uint64_t values[NUM_EVENTS] = {};
+
+    Sample& operator+=(const Sample& other);
+    Sample operator-(const Sample& other) const;
+  };
+
+  // Opens the counters on the calling thread. Returns false, with the reason
+  // in 'error', if none of them could be opened.
+  static bool open(std::string& error);
+  static inline bool isOpen() { return s_open; }
+  static bool available(Event event);
+  static const char* name(Event event);
+  // The counters now, scaled up if the kernel had to multiplex them.
+  static Sample read();
+
+  // Also count the calls the top level of the script makes, per function.
+  static void setCountCalls(bool count) { s_count_calls = count; }
+  static inline bool countCalls() { return s_count_calls; }
+  // Adds a call of 'fn' that started when the counters were at 'start'.
+  static void addCall(const Function* fn, const Sample& start);
+  static void printCalls(FILE* out);
+
+ private:
+  static inline bool s_open = false;
+  static inline bool s_count_calls = false;
+};
+
+}  // namespace Linaro
+
+#endif  // PERF_COUNTERS_H
@@ -0,0 +1,176 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../linaro_utils/common.h"
+#include "../parsing/token.h"
+#include "objects.h"
+
+namespace Linaro {
+
+namespace {
+
+struct Row {
+  std::string name;
+  int line;
+  Profiler::Counter counter;
+};
+
+// Counters of the VMs flushed so far.
+struct Totals {
+  std::mutex lock;
+  Profiler::Counter opcodes[Bytecode::NUM_BYTECODES];
+  std::map<std::string, Profiler::Counter> functions;
+  std::map<std::pair<std::string, int>, Profiler::Counter> lines;
+  bool print = false;
+  std::string json_file;
+};
+
+}  // namespace
+
+static Totals &totals() {
+  static Totals totals;
+  return totals;
+}
+
+static void addCounter(Profiler::Counter &to, const Profiler::Counter &from) {
+  to.count += from.count;
+  to.cycles += from.cycles;
+}
+
+void Profiler::charge(uint64_t cycles) {
+  Location loc = m_code->getLocation(m_offset);
+  Counter *counters[] = {&m_opcodes[m_op], &m_functions[m_fn],
+                         &m_lines[{loc.file, loc.line}]};
+  for (Counter *counter : counters) {
+    counter->count++;
+    counter->cycles += cycles;
+  }
+}
+
+void Profiler::flush() {
+  if (m_code != nullptr) charge(readCycles() - m_start);
+  m_fn = nullptr;
+  m_code = nullptr;
+  Totals &all = totals();
+  std::lock_guard<std::mutex> lock(all.lock);
+  for (int op = 0; op < Bytecode::NUM_BYTECODES; op++) {
+    addCounter(all.opcodes[op], m_opcodes[op]);
+    m_opcodes[op] = Counter();
+  }
+  for (const auto &[fn, counter] : m_functions) {
+    addCounter(all.functions[std::string(fn->name())], counter);
+  }
+  for (const auto &[line, counter] : m_lines) {
+    addCounter(all.lines[{line.first, line.second}], counter);
+  }
+  m_functions.clear();
+  m_lines.clear();
+}
+
+void Profiler::enable(bool print, const char *json_file) {
+  Totals &all = totals();
+  all.print = print;
+  if (json_file != nullptr) all.json_file = json_file;
+  s_enabled = print || json_file != nullptr;
+}
+
+// Rows sorted by cycles, most first.
+static std::vector<Row> sortRows(std::vector<Row> rows) {
+  std::sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+    return a.counter.cycles > b.counter.cycles;
+  });
+  return rows;
+}
+
+static void printRows(FILE *out, const char *title,
+                      const std::vector<Row> &rows, uint64_t total_cycles) {
+  fprintf(out, "\n%-32s %12s %14s %7s %10s\n", title, "count", "cycles", "%",
+          "cycles/op");
+  int printed = 0;
+  for (const Row &row : rows) {
+    if (printed++ == PROFILE_REPORT_ROWS) break;
+    std::string name = row.name;
+    if (row.line >= 0) name += ":" + std::to_string(row.line);
+    fprintf(out, "%-32s %12llu %14llu %6.2f%% %10.1f\n", name.c_str(),
+            (unsigned long long)row.counter.count,
+            (unsigned long long)row.counter.cycles,
+            total_cycles == 0 ? 0.0 : 100.0 * row.counter.cycles / total_cycles,
+            row.counter.count == 0
+                ? 0.0
+                : (double)row.counter.cycles / row.counter.count);
+  }
+}
+
+static void writeString(FILE *out, const std::string &str) {
+  fputc('"', out);
+  for (char c : str) {
+    if (c == '"' || c == '\\') fputc('\\', out);
+    fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+static void writeRows(FILE *out, const char *key, const char *name_key,
+                      const std::vector<Row> &rows, bool last) {
+  fprintf(out, "  \"%s\": [", key);
+  for (size_t i = 0; i < rows.size(); i++) {
+    fprintf(out, "%s\n    {\"%s\": ", i == 0 ? "" : ",", name_key);
+    writeString(out, rows[i].name);
+    if (rows[i].line >= 0) fprintf(out, ", \"line\": %d", rows[i].line);
+    fprintf(out, ", \"count\": %llu, \"cycles\": %llu}",
+            (unsigned long long)rows[i].counter.count,
+            (unsigned long long)rows[i].counter.cycles);
+  }
+  fprintf(out, "\n  ]%s\n", last ? "" : ",");
+}
+
+void Profiler::report() {
+  Totals &all = totals();
+  std::lock_guard<std::mutex> lock(all.lock);
+  std::vector<Row> opcodes, functions, lines;
+  uint64_t total_count = 0, total_cycles = 0;
+  for (int op = 0; op < Bytecode::NUM_BYTECODES; op++) {
+    if (all.opcodes[op].count == 0) continue;
+    opcodes.push_back({bytecode_to_string[op], -1, all.opcodes[op]});
+    total_count += all.opcodes[op].count;
+    total_cycles += all.opcodes[op].cycles;
+  }
+  for (const auto &[name, counter] : all.functions) {
+    functions.push_back({name, -1, counter});
+  }
+  for (const auto &[line, counter] : all.lines) {
+    lines.push_back({line.first, line.second, counter});
+  }
+  opcodes = sortRows(std::move(opcodes));
+  functions = sortRows(std::move(functions));
+  lines = sortRows(std::move(lines));
+
+  if (all.print) {
+    fprintf(stderr, "\n---- PROFILE ----\n\n");
+    fprintf(stderr, "%llu instructions, %llu cycles\n",
+            (unsigned long long)total_count, (unsigned long long)total_cycles);
+    printRows(stderr, "opcode", opcodes, total_cycles);
+    printRows(stderr, "function", functions, total_cycles);
+    printRows(stderr, "line", lines, total_cycles);
+  }
+  if (!all.json_file.empty()) {
+    FILE *out = fopen(all.json_file.c_str(), "w");
+    if (out == nullptr) {
+      fprintf(stderr, "Failed to write %s\n", all.json_file.c_str());
+      return;
+    }
+    fprintf(out, "{\n  \"instructions\": %llu,\n  \"cycles\": %llu,\n",
+            (unsigned long long)total_count, (unsigned long long)total_cycles);
+    writeRows(out, "opcodes", "name", opcodes, false);
+    writeRows(out, "functions", "name", functions, false);
+    writeRows(out, "lines", "file", lines, true);
+    fprintf(out, "}\n");
+    fclose(out);
+  }
+}
+
+}  // namespace Linaro
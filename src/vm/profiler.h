@@ -0,0 +1,90 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+#include "../code_generator/chunk.h"
+
+namespace Linaro {
+
+class Function;
+
+// Time stamp counter, or nanoseconds where there is none.
+inline uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+// Counts how often every opcode, function and source line is executed, and
+// the cycles spent on them, for the VM it belongs to. An instruction is
+// charged the cycles from its dispatch to the next one, so a call is charged
+// the native it runs but not the bytecode of the callee.
+//
+// Only used when built with LINARO_PROFILE, the VM doesn't call it otherwise.
+class Profiler {
+ public:
+  struct Counter {
+    uint64_t count = 0;
+    uint64_t cycles = 0;
+  };
+
+  // Called when the instruction at 'offset' of 'code', which belongs to
+  // 'fn', is dispatched.
+  inline void instruction(const Function *fn, const BytecodeChunk *code,
+                          uint32_t offset, Bytecode op) {
+    uint64_t now = readCycles();
+    if (m_code != nullptr) charge(now - m_start);
+    m_fn = fn;
+    m_code = code;
+    m_offset = offset;
+    m_op = op;
+    // Leaves out the time taken to count.
+    m_start = readCycles();
+  }
+
+  // Adds the counters to the ones of the process and clears them. Has to be
+  // called while the functions counted are still alive.
+  void flush();
+
+  // Enables printing the report of the process at exit, with '--profile',
+  // and writing it as JSON to 'json_file', with '--profile-json'.
+  static void enable(bool print, const char *json_file);
+  static inline bool enabled() { return s_enabled; }
+  // Prints what enable() asked for.
+  static void report();
+
+ private:
+  static inline bool s_enabled = false;
+
+  void charge(uint64_t cycles);
+
+  // The instruction running.
+  const Function *m_fn = nullptr;
+  const BytecodeChunk *m_code = nullptr;
+  uint32_t m_offset = 0;
+  Bytecode m_op = Bytecode::nop;
+  uint64_t m_start = 0;
+
+  Counter m_opcodes[Bytecode::NUM_BYTECODES];
+  std::unordered_map<const Function *, Counter> m_functions;
+  std::map<std::pair<const char *, int>, Counter> m_lines;
+};
+
+}  // namespace Linaro
+
+#endif  // PROFILER_H
@@ -0,0 +1,67 @@
+#include "program.h"
+
+#include "../code_generator/code_generator.h"
+#include "natives.h"
+#include "tracer.h"
+
+namespace Linaro {
+
+std::shared_ptr<const Program> Program::compile(const char* filename,
+                                                RunStats* stats) {
+  CHECK(filename != nullptr);
+  PhaseTimer parse_timer;
+  uint64_t num_nodes = Node::numCreated();
+  std::shared_ptr<Program> program;
+  {
+    TraceSpan span("parse", "compiler");
+    program.reset(new Program(filename));
+    program->m_ast = program->m_parser.parse();
+  }
+  PhaseTime parse = parse_timer.elapsed();
+
+  PhaseTimer compile_timer;
+  {
+    TraceSpan span("compile", "compiler");
+    program->m_top_level =
+        CodeGenerator::compile(program->m_ast.get(), program->m_functions);
+  }
+
+  if (stats != nullptr) {
+    stats->compile += compile_timer.elapsed();
+    stats->parse += parse;
+    stats->tokens += program->m_parser.numTokens();
+    stats->ast_nodes += Node::numCreated() - num_nodes;
+    for (Function* fn : program->m_functions) {
+      stats->bytecode_bytes += fn->code()->chunkSize();
+      stats->constants.push_back({std::string(fn->name()), fn->numConstants()});
+    }
+  }
+  return program;
+}
+
+#ifdef DEBUG
+void Program::printFunctions() const {
+  for (Function* fn : m_functions) {
+    fn->printFunction();
+  }
+}
+#endif
+
+Isolate::Isolate(std::shared_ptr<const Program> program, ActorSystem* actors,
+                 int actor_id)
+    : program{std::move(program)}, actors{actors}, actor_id{actor_id} {
+  globals.resize(this->program->numGlobals());
+  Natives::install(globals);
+  profiles.resize(this->program->functions().size());
+  for (Function* fn : this->program->functions()) {
+    profile(fn).loop_counters.resize(fn->numLoops());
+  }
+}
+
+Isolate::~Isolate() {
+  // Cycles reachable from the globals would outlive the isolate otherwise.
+  globals.clear();
+  heap.collect();
+}
+
+}  // namespace Linaro
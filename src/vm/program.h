@@ -0,0 +1,97 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../parsing/parser.h"
+#include "heap.h"
+#include "objects.h"
+#include "stats.h"
+
+namespace Linaro {
+
+class ActorSystem;
+
+// A compiled script. Nothing in it changes once it has been compiled, so any
+// number of isolates can run it at the same time on different threads.
+// Everything that changes while a script runs is kept in the Isolate.
+class Program {
+ public:
+  // Adds what compiling took to 'stats', if given.
+  static std::shared_ptr<const Program> compile(const char* filename,
+                                                RunStats* stats = nullptr);
+
+  Function* topLevel() const { return m_top_level.get(); }
+  // Every function of the program, indexed by Function::id().
+  const std::vector<Function*>& functions() const { return m_functions; }
+  int numGlobals() const { return m_top_level->numLocals(); }
+
+#ifdef DEBUG
+  void printFunctions() const;
+#endif
+
+ private:
+  Program(const char* filename) : m_parser{filename} {}
+
+  // Names in the functions point into the source held by the parser.
+  Parser m_parser;
+  FunctionLiteralPtr m_ast;
+  std::unique_ptr<Function> m_top_level;
+  std::vector<Function*> m_functions;
+};
+
+// How the VMs running a script behave, set from the command line.
+struct VMOptions {
+  // Print every bailout from optimized code and a summary at exit.
+  bool trace_deopt = false;
+  // Print the pauses of the cycle collector at exit.
+  bool print_gc_stats = false;
+  // Compact the node table of the collector once it's fragmented, see Heap.
+  bool compact_nodes = false;
+  // Allocate the objects of each run() in a region of the nursery, and drop
+  // the region at the end instead of freeing the objects one by one. Nothing
+  // of the run may be used after it, and the memory the objects own is
+  // leaked, so it's only for running a script and exiting.
+  bool arena = false;
+};
+
+// One running instance of a program, with its own globals and profiles.
+// Shared by the VM running the script and the VMs running its fibers, but
+// by nothing else.
+struct Isolate {
+  explicit Isolate(std::shared_ptr<const Program> program,
+                   ActorSystem* actors = nullptr, int actor_id = 0);
+  ~Isolate();
+
+  FunctionProfile& profile(const Function* fn) { return profiles[fn->id()]; }
+
+  // Once the isolate has fibers, loads and stores of a global hold its
+  // lock, so that no one sees a value half written.
+  std::mutex& globalLock(int index) {
+    return global_locks[index % GLOBAL_LOCK_STRIPES];
+  }
+
+  std::shared_ptr<const Program> program;
+  std::vector<Value> globals;
+  std::mutex global_locks[GLOBAL_LOCK_STRIPES];
+  std::vector<FunctionProfile> profiles;
+  Heap heap;
+
+  // Fibers spawned that aren't done yet.
+  std::atomic<int> num_fibers{0};
+  // Set once a fiber has been spawned. From then on the VMs of the isolate
+  // run on several OS threads, and the profiles are left alone since they
+  // aren't synchronized.
+  std::atomic<bool> has_fibers{false};
+
+  // The actors the isolate runs with, if it runs as one.
+  ActorSystem* actors;
+  int actor_id;
+};
+
+}  // namespace Linaro
+
+#endif  // PROGRAM_H
@@ -0,0 +1,73 @@
+#include "sampler.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "../linaro_utils/common.h"
+
+namespace Linaro {
+
+namespace {
+
+struct Samples {
+  std::mutex lock;
+  std::map<std::string, uint64_t> stacks;
+  std::thread timer;
+  std::condition_variable stopped;
+  bool stopping = false;
+};
+
+}  // namespace
+
+static Samples &samples() {
+  static Samples samples;
+  return samples;
+}
+
+void Sampler::start(int hz) {
+  auto interval = std::chrono::microseconds(
+      1000000 / (hz > 0 ? hz : SAMPLER_DEFAULT_HZ));
+  Samples &all = samples();
+  all.timer = std::thread([&all, interval] {
+    std::unique_lock<std::mutex> lock(all.lock);
+    auto next = std::chrono::steady_clock::now();
+    for (;;) {
+      next += interval;
+      if (all.stopped.wait_until(lock, next, [&all] { return all.stopping; }))
+        return;
+      s_pending.store(true, std::memory_order_relaxed);
+    }
+  });
+}
+
+bool Sampler::stop(const char *file) {
+  Samples &all = samples();
+  {
+    std::lock_guard<std::mutex> lock(all.lock);
+    all.stopping = true;
+  }
+  all.stopped.notify_one();
+  all.timer.join();
+  s_pending = false;
+
+  FILE *out = fopen(file, "w");
+  if (out == nullptr) return false;
+  std::lock_guard<std::mutex> lock(all.lock);
+  for (const auto &[stack, count] : all.stacks) {
+    fprintf(out, "%s %llu\n", stack.c_str(), (unsigned long long)count);
+  }
+  fclose(out);
+  return true;
+}
+
+void Sampler::record(const std::string &stack) {
+  Samples &all = samples();
+  std::lock_guard<std::mutex> lock(all.lock);
+  all.stacks[stack]++;
+}
+
+}  // namespace Linaro
@@ -0,0 +1,40 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <atomic>
+#include <string>
+
+namespace Linaro {
+
+// Samples the call stacks of the running scripts at a fixed rate, and
+// writes how often each stack was seen in the folded format of flame graph
+// tools: "fn:line;fn:line;... count".
+//
+// A thread of the sampler only raises a flag, and the first VM to reach a
+// loop's back edge or a call after it records its own call stack, so the
+// stacks are never read while they change. Straight-line code runs for a
+// bounded time between those. (SIGPROF timers would do the same, but their
+// rate is bound to the kernel's tick.)
+class Sampler {
+ public:
+  // Starts sampling, 'hz' times a second.
+  static void start(int hz);
+  // Stops sampling and writes the samples to 'file'. Returns false if it
+  // can't be written.
+  static bool stop(const char *file);
+
+  // Whether a sample is due. Only the caller that gets true takes it.
+  static inline bool takeSample() {
+    return s_pending.load(std::memory_order_relaxed) &&
+           s_pending.exchange(false, std::memory_order_relaxed);
+  }
+  // Adds a sample of 'stack', the frames from the bottom up separated by ';'.
+  static void record(const std::string &stack);
+
+ private:
+  static inline std::atomic<bool> s_pending{false};
+};
+
+}  // namespace Linaro
+
+#endif  // SAMPLER_H
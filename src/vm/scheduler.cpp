@@ -0,0 +1,237 @@
+#include "scheduler.h"
+
+#include "tracer.h"
+#include "vm.h"
+
+namespace Linaro {
+
+int Scheduler::s_num_workers = 0;
+
+// Queue of the OS thread, see m_queues.
+static thread_local int t_queue = 0;
+// Whether the OS thread is a worker or a spare.
+static thread_local bool t_in_pool = false;
+
+// How long joinAll() blocks before it looks for other fibers to run.
+static const std::chrono::milliseconds JOIN_POLL_INTERVAL{1};
+
+Scheduler& Scheduler::get() {
+  static Scheduler scheduler(
+      s_num_workers > 0
+          ? s_num_workers
+          : std::max(1, (int)std::thread::hardware_concurrency()));
+  return scheduler;
+}
+
+Scheduler::Scheduler(int num_workers) {
+  for (int i = 0; i <= num_workers; i++) {
+    m_queues.push_back(std::make_unique<WorkQueue>());
+  }
+  for (int i = 1; i <= num_workers; i++) {
+    m_workers.emplace_back(&Scheduler::workerLoop, this, i);
+  }
+}
+
+Scheduler::~Scheduler() {
+  {
+    std::lock_guard<std::mutex> lock(m_idle_lock);
+    m_stopping = true;
+  }
+  m_idle.notify_all();
+  m_spare_wake.notify_all();
+  for (std::thread& worker : m_workers) worker.join();
+  std::vector<std::thread> spares;
+  {
+    std::lock_guard<std::mutex> lock(m_idle_lock);
+    spares.swap(m_spares);
+  }
+  for (std::thread& spare : spares) spare.join();
+}
+
+void Scheduler::spawn(std::shared_ptr<Thread> fiber) {
+  if (Tracer::enabled()) Tracer::instant("spawn", "fiber");
+  Isolate& isolate = *fiber->isolate();
+  isolate.has_fibers.store(true, std::memory_order_relaxed);
+  Array::setShared();
+  isolate.num_fibers++;
+  {
+    WorkQueue& queue = *m_queues[t_queue];
+    std::lock_guard<std::mutex> lock(queue.lock);
+    queue.fibers.push_back(std::move(fiber));
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_idle_lock);
+    m_queued++;
+  }
+  m_idle.notify_one();
+}
+
+void Scheduler::join(Thread& fiber) {
+  TraceSpan span("join", "fiber");
+  run(fiber);
+  if (fiber.isDone()) return;
+  if (t_in_pool) blockWorker();
+  fiber.wait();
+  if (t_in_pool) unblockWorker();
+}
+
+void Scheduler::joinAll(const Isolate& isolate) {
+  while (isolate.num_fibers > 0) {
+    std::shared_ptr<Thread> fiber = findWork(t_queue);
+    if (fiber != nullptr) {
+      run(*fiber);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_idle_lock);
+    m_idle.wait_for(lock, JOIN_POLL_INTERVAL, [this, &isolate] {
+      return m_queued > 0 || isolate.num_fibers == 0;
+    });
+  }
+}
+
+bool Scheduler::runPending() {
+  // The caller may be a fiber, the one run here would be stacked on it.
+  if (t_in_pool) return false;
+  std::shared_ptr<Thread> fiber = findWork(t_queue);
+  if (fiber == nullptr) return false;
+  run(*fiber);
+  return true;
+}
+
+int Scheduler::numChunks(size_t size) {
+  if (size < 2 * (size_t)PARALLEL_MIN_CHUNK) return 1;
+  size_t max_chunks =
+      PARALLEL_CHUNKS_PER_WORKER * std::max(1, get().numWorkers());
+  return (int)std::min(size / PARALLEL_MIN_CHUNK, max_chunks);
+}
+
+bool Scheduler::runChunks(const std::shared_ptr<Isolate>& isolate,
+                          size_t size, int num_chunks, const ChunkBody& body) {
+  if (num_chunks == 1) {
+    VM vm(isolate);
+    return body(vm, 0, 0, size);
+  }
+  std::vector<std::shared_ptr<Thread>> chunks;
+  for (int c = 0; c < num_chunks; c++) {
+    size_t begin = size * c / num_chunks;
+    size_t end = size * (c + 1) / num_chunks;
+    auto task = [&body, c, begin, end](VM& vm) {
+      return Value(body(vm, c, begin, end));
+    };
+    auto chunk = std::make_shared<Thread>(task, isolate);
+    get().spawn(chunk);
+    chunks.push_back(std::move(chunk));
+  }
+  bool ok = true;
+  for (auto& chunk : chunks) {
+    get().join(*chunk);
+    ok = ok && chunk->result().asBoolean();
+  }
+  return ok;
+}
+
+void Scheduler::workerLoop(int queue) {
+  t_queue = queue;
+  t_in_pool = true;
+  for (;;) {
+    std::shared_ptr<Thread> fiber = findWork(queue);
+    if (fiber != nullptr) {
+      run(*fiber);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_idle_lock);
+    m_idle.wait(lock, [this] { return m_queued > 0 || m_stopping; });
+    if (m_stopping) return;
+  }
+}
+
+void Scheduler::spareLoop() {
+  t_in_pool = true;
+  std::unique_lock<std::mutex> lock(m_idle_lock);
+  for (;;) {
+    while (!m_stopping && m_active_spares <= m_blocked_workers) {
+      lock.unlock();
+      std::shared_ptr<Thread> fiber = findWork(t_queue);
+      if (fiber != nullptr) run(*fiber);
+      lock.lock();
+      if (fiber != nullptr) continue;
+      m_idle.wait(lock, [this] {
+        return m_queued > 0 || m_stopping ||
+               m_active_spares > m_blocked_workers;
+      });
+    }
+    if (m_stopping) return;
+    m_active_spares--;
+    m_parked_spares++;
+    m_spare_wake.wait(lock,
+                      [this] { return m_spare_wakeups > 0 || m_stopping; });
+    if (m_stopping) return;
+    m_spare_wakeups--;
+  }
+}
+
+void Scheduler::blockWorker() {
+  std::lock_guard<std::mutex> lock(m_idle_lock);
+  m_blocked_workers++;
+  if (m_active_spares >= m_blocked_workers) return;
+  m_active_spares++;
+  if (m_parked_spares > 0) {
+    m_parked_spares--;
+    m_spare_wakeups++;
+    m_spare_wake.notify_one();
+  } else {
+    m_spares.emplace_back(&Scheduler::spareLoop, this);
+  }
+}
+
+void Scheduler::unblockWorker() {
+  {
+    std::lock_guard<std::mutex> lock(m_idle_lock);
+    m_blocked_workers--;
+  }
+  // Lets an idle spare park.
+  m_idle.notify_all();
+}
+
+std::shared_ptr<Thread> Scheduler::findWork(int queue) {
+  int num_queues = m_queues.size();
+  for (int i = 0; i < num_queues; i++) {
+    WorkQueue& victim = *m_queues[(queue + i) % num_queues];
+    std::lock_guard<std::mutex> lock(victim.lock);
+    if (victim.fibers.empty()) continue;
+    std::shared_ptr<Thread> fiber;
+    if (i == 0) {
+      fiber = std::move(victim.fibers.back());
+      victim.fibers.pop_back();
+    } else {
+      fiber = std::move(victim.fibers.front());
+      victim.fibers.pop_front();
+    }
+    m_queued--;
+    return fiber;
+  }
+  return nullptr;
+}
+
+void Scheduler::run(Thread& fiber) {
+  if (!fiber.tryStart()) return;
+  // The fiber lets go of its isolate once it's done.
+  std::shared_ptr<Isolate> isolate = fiber.isolate();
+  Value result(ValueType::nNoll);
+  {
+    // Gone before anyone can see that the fiber finished.
+    TraceSpan span("fiber", "fiber");
+    VM vm(isolate);
+    if (fiber.task())
+      result = fiber.task()(vm);
+    else
+      vm.runFiber(fiber.closure(), fiber.arguments(), result);
+  }
+  fiber.finish(result);
+  if (--isolate->num_fibers == 0) {
+    std::lock_guard<std::mutex> lock(m_idle_lock);
+    m_idle.notify_all();
+  }
+}
+
+}  // namespace Linaro
@@ -0,0 +1,118 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "objects.h"
+#include "program.h"
+
+namespace Linaro {
+
+// Runs fibers (see Thread) on a pool of OS worker threads. Every worker has
+// a queue of fibers: it pushes the fibers it spawns at the back and takes
+// its next fiber from there, while idle workers steal from the front of the
+// other queues. A fiber runs to completion on the worker that started it. A
+// thread joining an unfinished fiber runs the fiber itself if nobody has
+// started it yet, and otherwise blocks. A fiber started on top of the joiner
+// couldn't return before the joiner does, so a worker blocking in a join has
+// a spare thread take its place in the pool until it resumes.
+class Scheduler {
+ public:
+  // The scheduler of the process. The workers are started on first use.
+  static Scheduler& get();
+
+  // Number of workers, has to be set before the first get(). Defaults to
+  // the number of cores. Spares standing in for blocked workers don't count.
+  static void setNumWorkers(int num_workers) { s_num_workers = num_workers; }
+  int numWorkers() const { return m_workers.size(); }
+
+  void spawn(std::shared_ptr<Thread> fiber);
+
+  // Returns once 'fiber' is done.
+  void join(Thread& fiber);
+
+  // Returns once every fiber of 'isolate' is done.
+  void joinAll(const Isolate& isolate);
+
+  // Runs one queued fiber, if there is any. Returns false otherwise, and
+  // always on the threads of the pool.
+  bool runPending();
+
+  // Processes the iterations [begin, end) of chunk 'chunk' on 'vm'. Returns
+  // false on a runtime error.
+  using ChunkBody =
+      std::function<bool(VM& vm, int chunk, size_t begin, size_t end)>;
+
+  // Chunks to split 'size' iterations into, at least PARALLEL_MIN_CHUNK
+  // iterations each.
+  static int numChunks(size_t size);
+
+  // Splits [0, size) into 'num_chunks' chunks and runs 'body' on each, every
+  // chunk in a fiber of 'isolate' on a VM of its own. A single chunk runs on
+  // the calling thread instead. Returns once every chunk is done.
+  static bool runChunks(const std::shared_ptr<Isolate>& isolate, size_t size,
+                        int num_chunks, const ChunkBody& body);
+
+  ~Scheduler();
+
+ private:
+  explicit Scheduler(int num_workers);
+
+  struct WorkQueue {
+    std::mutex lock;
+    std::deque<std::shared_ptr<Thread>> fibers;
+  };
+
+  void workerLoop(int queue);
+
+  // Runs fibers while more workers are blocked than spares stand in for
+  // them, and sleeps otherwise.
+  void spareLoop();
+
+  // Called by a thread of the pool around blocking in a join.
+  void blockWorker();
+  void unblockWorker();
+
+  // Takes the next fiber from the back of 'queue', or steals one from the
+  // front of some other queue.
+  std::shared_ptr<Thread> findWork(int queue);
+
+  // Runs 'fiber' unless some other worker already started it.
+  void run(Thread& fiber);
+
+  // Queue 0 takes the fibers spawned from threads outside the pool, worker
+  // i owns queue i + 1.
+  std::vector<std::unique_ptr<WorkQueue>> m_queues;
+  std::vector<std::thread> m_workers;
+
+  // Idle workers sleep here until fibers are queued.
+  std::mutex m_idle_lock;
+  std::condition_variable m_idle;
+  bool m_stopping = false;
+
+  // Fibers in the queues, including ones some joiner has started already.
+  std::atomic<int> m_queued{0};
+
+  // Guarded by m_idle_lock. Spares take fibers from queue 0 and steal like
+  // the workers do.
+  std::vector<std::thread> m_spares;
+  int m_blocked_workers = 0;
+  int m_active_spares = 0;
+  int m_parked_spares = 0;
+  // Parked spares to wake up, one per worker that blocked.
+  int m_spare_wakeups = 0;
+  std::condition_variable m_spare_wake;
+
+  static int s_num_workers;
+};
+
+}  // namespace Linaro
+
+#endif  // SCHEDULER_H
@@ -0,0 +1,107 @@
+#include "stats.h"
+
+#include <sys/resource.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "../linaro_utils/common.h"
+
+namespace Linaro {
+
+static double seconds(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+PhaseTime PhaseTimer::now() {
+  PhaseTime time;
+  time.wall = seconds(CLOCK_MONOTONIC);
+  time.cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+  if (PerfCounters::isOpen()) time.counters = PerfCounters::read();
+  return time;
+}
+
+PhaseTime PhaseTimer::elapsed() const {
+  PhaseTime end = now();
+  end.wall -= m_start.wall;
+  end.cpu -= m_start.cpu;
+  end.counters = end.counters - m_start.counters;
+  return end;
+}
+
+// Hardware counters of each phase, with the instructions per cycle and the
+// branch misses per thousand instructions.
+static void printCounters(
+    FILE* out, const std::vector<std::pair<const char*, PhaseTime>>& phases) {
+  fprintf(out, "%-10s", "phase");
+  for (int event = 0; event < PerfCounters::NUM_EVENTS; event++) {
+    fprintf(out, " %14s", PerfCounters::name(static_cast<PerfCounters::Event>(event)));
+  }
+  fprintf(out, " %6s %12s\n", "IPC", "br-miss/ki");
+  for (const auto& [name, time] : phases) {
+    const uint64_t* values = time.counters.values;
+    fprintf(out, "%-10s", name);
+    for (int event = 0; event < PerfCounters::NUM_EVENTS; event++) {
+      if (PerfCounters::available(static_cast<PerfCounters::Event>(event)))
+        fprintf(out, " %14llu", (unsigned long long)values[event]);
+      else
+        fprintf(out, " %14s", "n/a");
+    }
+    uint64_t instructions = values[PerfCounters::instructions];
+    uint64_t cycles = values[PerfCounters::cycles];
+    fprintf(out, " %6.2f %12.2f\n",
+            cycles == 0 ? 0.0 : (double)instructions / cycles,
+            instructions == 0
+                ? 0.0
+                : 1000.0 * values[PerfCounters::branch_misses] / instructions);
+  }
+  fprintf(out, "\n");
+}
+
+long RunStats::peakRssKb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+void RunStats::print(FILE* out) const {
+  fprintf(out, "\n---- STATS ----\n\n");
+  fprintf(out, "%-10s %12s %12s\n", "phase", "wall ms", "cpu ms");
+  std::vector<std::pair<const char*, PhaseTime>> phases = {
+      {"lex+parse", parse}, {"compile", compile}, {"execute", execute}};
+  PhaseTime total;
+  for (const auto& [name, time] : phases) {
+    fprintf(out, "%-10s %12.3f %12.3f\n", name, time.wall * 1000,
+            time.cpu * 1000);
+    total += time;
+  }
+  fprintf(out, "%-10s %12.3f %12.3f\n\n", "total", total.wall * 1000,
+          total.cpu * 1000);
+  phases.push_back({"total", total});
+  if (PerfCounters::isOpen()) printCounters(out, phases);
+
+  uint64_t num_constants = 0;
+  for (const auto& fn : constants) num_constants += fn.second;
+  fprintf(out, "tokens:         %llu\n", (unsigned long long)tokens);
+  fprintf(out, "AST nodes:      %llu\n", (unsigned long long)ast_nodes);
+  fprintf(out, "functions:      %zu\n", constants.size());
+  fprintf(out, "bytecode bytes: %llu\n", (unsigned long long)bytecode_bytes);
+  fprintf(out, "constants:      %llu\n", (unsigned long long)num_constants);
+  fprintf(out, "peak RSS:       %ld kB\n", peakRssKb());
+
+  auto largest = constants;
+  std::stable_sort(
+      largest.begin(), largest.end(),
+      [](const auto& a, const auto& b) { return a.second > b.second; });
+  if (largest.size() > (size_t)STATS_REPORT_FUNCTIONS)
+    largest.resize(STATS_REPORT_FUNCTIONS);
+  fprintf(out, "\n%-32s %10s\n", "function", "constants");
+  for (const auto& [name, num] : largest) {
+    fprintf(out, "%-32s %10d\n", name.c_str(), num);
+  }
+  if (PerfCounters::countCalls()) PerfCounters::printCalls(out);
+}
+
+}  // namespace Linaro
@@ -0,0 +1,64 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perf_counters.h"
+
+namespace Linaro {
+
+// Wall and CPU time of a phase, in seconds. The CPU time is the process's,
+// so it includes the threads running fibers. The hardware counters, if
+// open, are only the main thread's.
+struct PhaseTime {
+  double wall = 0;
+  double cpu = 0;
+  PerfCounters::Sample counters;
+
+  PhaseTime& operator+=(const PhaseTime& other) {
+    wall += other.wall;
+    cpu += other.cpu;
+    counters += other.counters;
+    return *this;
+  }
+};
+
+// Measures a phase from its construction on.
+class PhaseTimer {
+ public:
+  PhaseTimer() : m_start{now()} {}
+  PhaseTime elapsed() const;
+
+ private:
+  static PhaseTime now();
+  PhaseTime m_start;
+};
+
+// What compiling and running scripts took, see Program::compile() and
+// VM::setStats(). Phases and counts add up over the scripts.
+struct RunStats {
+  // The parser pulls the tokens from the lexer one at a time, so this is
+  // lexing and parsing together.
+  PhaseTime parse;
+  PhaseTime compile;
+  PhaseTime execute;
+
+  uint64_t tokens = 0;
+  uint64_t ast_nodes = 0;
+  uint64_t bytecode_bytes = 0;
+  // Name and number of constants of every function.
+  std::vector<std::pair<std::string, int>> constants;
+
+  // Largest resident set of the process so far, in kB.
+  static long peakRssKb();
+
+  void print(FILE* out) const;
+};
+
+}  // namespace Linaro
+
+#endif  // STATS_H
@@ -0,0 +1,198 @@
+#include "tracer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../linaro_utils/common.h"
+#include "objects.h"
+
+namespace Linaro {
+
+namespace {
+
+struct TraceEvent {
+  uint64_t ts;
+  // Duration of complete events, id of async ones.
+  uint64_t arg;
+  const char* name;
+  const char* category;
+  char phase;
+};
+
+struct ThreadBuffer {
+  int tid;
+  // Only contended while write() copies the events, workers may still
+  // record while the process exits.
+  std::mutex lock;
+  // Ring of the calls, all of them up to 'num_calls' were recorded, the
+  // ones before the last TRACE_BUFFER_EVENTS were overwritten.
+  std::vector<TraceEvent> calls;
+  uint64_t num_calls = 0;
+  std::vector<TraceEvent> events;
+  std::unordered_map<const Function*, const char*> names;
+};
+
+struct Buffers {
+  std::mutex lock;
+  std::vector<std::unique_ptr<ThreadBuffer>> threads;
+  // Interned function names.
+  std::deque<std::string> names;
+  std::atomic<uint64_t> next_id{1};
+};
+
+}  // namespace
+
+// Never destroyed, threads may still record while the process exits.
+static Buffers& buffers() {
+  static Buffers* buffers = new Buffers();
+  return *buffers;
+}
+
+static thread_local ThreadBuffer* t_buffer = nullptr;
+
+static ThreadBuffer& threadBuffer() {
+  if (t_buffer == nullptr) {
+    Buffers& all = buffers();
+    std::lock_guard<std::mutex> lock(all.lock);
+    all.threads.push_back(std::make_unique<ThreadBuffer>());
+    t_buffer = all.threads.back().get();
+    t_buffer->tid = all.threads.size();
+  }
+  return *t_buffer;
+}
+
+static void record(char phase, const char* name, const char* category,
+                   uint64_t ts, uint64_t arg = 0) {
+  ThreadBuffer& buffer = threadBuffer();
+  std::lock_guard<std::mutex> lock(buffer.lock);
+  buffer.events.push_back({ts, arg, name, category, phase});
+}
+
+static void recordCall(char phase, const char* name, const char* category) {
+  ThreadBuffer& buffer = threadBuffer();
+  uint64_t ts = Tracer::now();
+  std::lock_guard<std::mutex> lock(buffer.lock);
+  if (buffer.calls.empty()) buffer.calls.resize(TRACE_BUFFER_EVENTS);
+  buffer.calls[buffer.num_calls++ % TRACE_BUFFER_EVENTS] = {
+      ts, 0, name, category, phase};
+}
+
+uint64_t Tracer::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void Tracer::complete(const char* name, const char* category,
+                      uint64_t start) {
+  uint64_t end = now();
+  record('X', name, category, start, end - start);
+}
+
+void Tracer::begin(const char* name, const char* category) {
+  recordCall('B', name, category);
+}
+
+void Tracer::end(const char* name, const char* category) {
+  recordCall('E', name, category);
+}
+
+void Tracer::instant(const char* name, const char* category) {
+  record('i', name, category, now());
+}
+
+void Tracer::asyncBegin(const char* name, const char* category, uint64_t id) {
+  record('b', name, category, now(), id);
+}
+
+void Tracer::asyncEnd(const char* name, const char* category, uint64_t id) {
+  record('e', name, category, now(), id);
+}
+
+uint64_t Tracer::newId() { return buffers().next_id++; }
+
+const char* Tracer::functionName(const Function* fn) {
+  ThreadBuffer& buffer = threadBuffer();
+  auto it = buffer.names.find(fn);
+  if (it != buffer.names.end()) return it->second;
+  Buffers& all = buffers();
+  std::lock_guard<std::mutex> lock(all.lock);
+  all.names.emplace_back(fn->name());
+  return buffer.names[fn] = all.names.back().c_str();
+}
+
+static void writeString(FILE* out, const char* str) {
+  fputc('"', out);
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\') fputc('\\', out);
+    fputc(*str, out);
+  }
+  fputc('"', out);
+}
+
+bool Tracer::write(const char* file) {
+  FILE* out = fopen(file, "w");
+  if (out == nullptr) return false;
+  Buffers& all = buffers();
+  std::lock_guard<std::mutex> lock(all.lock);
+  fprintf(out, "{\"traceEvents\": [");
+  bool first = true;
+  for (const auto& thread : all.threads) {
+    fprintf(out, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+            "\"tid\": %d, \"args\": {\"name\": \"%s %d\"}}",
+            first ? "" : ",", thread->tid, thread->tid == 1 ? "main" : "thread",
+            thread->tid);
+    first = false;
+    std::vector<TraceEvent> events;
+    std::unique_lock<std::mutex> thread_lock(thread->lock);
+    uint64_t begin = thread->num_calls > (uint64_t)TRACE_BUFFER_EVENTS
+                         ? thread->num_calls - TRACE_BUFFER_EVENTS
+                         : 0;
+    // Once the ring has wrapped, the calls that were running at its oldest
+    // event have lost their begin, their end is dropped as well.
+    int depth = 0;
+    for (uint64_t i = begin; i < thread->num_calls; i++) {
+      const TraceEvent& call = thread->calls[i % TRACE_BUFFER_EVENTS];
+      if (call.phase == 'B') {
+        depth++;
+      } else if (depth == 0) {
+        continue;
+      } else {
+        depth--;
+      }
+      events.push_back(call);
+    }
+    events.insert(events.end(), thread->events.begin(), thread->events.end());
+    thread_lock.unlock();
+    // Spans are recorded once they end.
+    std::stable_sort(events.begin(), events.end(),
+                     [](const TraceEvent& a, const TraceEvent& b) {
+                       return a.ts < b.ts;
+                     });
+    for (const TraceEvent& event : events) {
+      fprintf(out, ",\n{\"name\": ");
+      writeString(out, event.name);
+      fprintf(out, ", \"cat\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, "
+              "\"pid\": 1, \"tid\": %d",
+              event.category, event.phase, event.ts / 1000.0, thread->tid);
+      if (event.phase == 'X') fprintf(out, ", \"dur\": %.3f", event.arg / 1000.0);
+      if (event.phase == 'b' || event.phase == 'e')
+        fprintf(out, ", \"id\": %llu", (unsigned long long)event.arg);
+      if (event.phase == 'i') fprintf(out, ", \"s\": \"t\"");
+      fprintf(out, "}");
+    }
+  }
+  fprintf(out, "\n], \"displayTimeUnit\": \"ns\"}\n");
+  fclose(out);
+  return true;
+}
+
+}  // namespace Linaro
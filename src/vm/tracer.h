@@ -0,0 +1,63 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <cstdint>
+
+namespace Linaro {
+
+class Function;
+
+// Records what the VM does as Chrome trace events, for chrome://tracing or
+// Perfetto: the compiler phases, calls, collector steps and cycles, and the
+// fibers. Every thread records into buffers of its own, and write() puts
+// them together at exit. Calls go to a ring buffer that keeps the last
+// TRACE_BUFFER_EVENTS of them, the other events are few enough to keep.
+//
+// Names have to outlive the tracer, they are literals or functionName()s.
+class Tracer {
+ public:
+  static void enable() { s_enabled = true; }
+  static inline bool enabled() { return s_enabled; }
+  // Writes the events recorded so far by all threads to 'file' as JSON.
+  static bool write(const char* file);
+
+  // Nanoseconds of a monotonic clock.
+  static uint64_t now();
+
+  // A span from 'start' to now.
+  static void complete(const char* name, const char* category, uint64_t start);
+  // A span from begin() to the matching end() on the same thread.
+  static void begin(const char* name, const char* category);
+  static void end(const char* name, const char* category);
+  static void instant(const char* name, const char* category);
+  // A span that may end on another thread, or overlap the others.
+  static void asyncBegin(const char* name, const char* category, uint64_t id);
+  static void asyncEnd(const char* name, const char* category, uint64_t id);
+  static uint64_t newId();
+
+  static const char* functionName(const Function* fn);
+
+ private:
+  static inline bool s_enabled = false;
+};
+
+// Records the time from its construction to its destruction as a span.
+class TraceSpan {
+ public:
+  TraceSpan(const char* name, const char* category)
+      : m_name{name},
+        m_category{category},
+        m_start{Tracer::enabled() ? Tracer::now() : 0} {}
+  ~TraceSpan() {
+    if (m_start != 0) Tracer::complete(m_name, m_category, m_start);
+  }
+
+ private:
+  const char* m_name;
+  const char* m_category;
+  uint64_t m_start;
+};
+
+}  // namespace Linaro
+
+#endif  // TRACER_H
@@ -4,6 +4,7 @@
 #include <cassert>
 #include <sstream>
 
+#include "allocation_profiler.h"
 #include "objects.h"
 
 namespace Linaro {
@@ -137,11 +138,24 @@ Value Value::operator-() const {
 
 #define bin_op(op) this->asNumber() op other.asNumber()
 
+static void appendString(std::string& out, const Value& val) {
+  if (val.isString())
+    out += val.valueTo<String>().str();
+  else
+    out += val.asString();
+}
+
 Value Value::operator+(const Value& other) {
   CHECK_FOR_NULL_VAL()
   if (isString() || other.isString() || !canBeNumber() ||
       !other.canBeNumber()) {
-    return Value(std::make_shared<String>(asString() + other.asString()));
+    // Built in place, the concatenation is moved into the new string.
+    std::string str;
+    appendString(str, *this);
+    appendString(str, other);
+    auto result = makeObject<String>(std::move(str));
+    AllocationProfiler::allocated(result);
+    return Value(result);
   }
   return Value(bin_op(+));
 }
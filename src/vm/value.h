@@ -2,6 +2,7 @@
 #define VALUE_H
 
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <variant>
@@ -11,7 +12,8 @@
 namespace Linaro {
 
 #define VALUES(V) V(Number) V(Boolean) V(Object) V(Undefined) V(Noll)
-#define OBJECTS(O) O(String) O(Function) O(Array) O(Closure) O(Thread)
+#define OBJECTS(O) \
+  O(String) O(Function) O(Array) O(Closure) O(Thread) O(NativeFunction)
 
 #define V(type) n##type,
 enum class ValueType : uint8_t { VALUES(V) };
@@ -41,8 +43,13 @@ class Object {
   virtual std::string asString() const { return "Undefined"; };
   virtual size_t hash() const = 0;
 
+  // Node of the object in the heap of its isolate, see Heap.
+  uint32_t heapIndex() const { return m_heap_index; }
+  void setHeapIndex(uint32_t index) { m_heap_index = index; }
+
  private:
   ObjectType m_type;
+  uint32_t m_heap_index = UINT32_MAX;
 };
 
 /* Linaro Value. Dynamically typed */
@@ -76,6 +83,10 @@ class Value {
 #undef O
   ValueType type() const { return m_type; }
 
+  // The number held by a value that is known to be a number. Lets
+  // specialized bytecodes update numbers in place.
+  inline double& rawNumber() { return *std::get_if<double>(&as); }
+
   // Convert from Value to a reference to corresponding Object
   template <typename T>
   inline T& valueTo() const {
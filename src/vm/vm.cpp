@@ -1,45 +1,118 @@
 #include "vm.h"
 
+#include <cmath>
+
 #include "../code_generator/chunk.h"
-#include "../code_generator/code_generator.h"
+#include "natives.h"
 
 namespace Linaro {
 
+StackFrame::StackFrame(Closure* closure,
+                       std::shared_ptr<OptimizedCode> optimized)
+    : closure{closure}, optimized{std::move(optimized)} {
+  locals.resize(this->optimized ? this->optimized->num_locals
+                                : closure->fun()->numLocals());
+}
+
 VMEndingStatus VM::interpret(const char* filename) {
   CHECK(filename != nullptr);
-  // initialize VM (todo)
-  Parser p(filename);
-  auto AST = p.parse();
-  auto top_level_fn = CodeGenerator::compile(AST.get());
-  Closure top_level_closure(top_level_fn.get());
-  m_call_stack.push(StackFrame(&top_level_closure));
-  m_globals.resize(top_level_fn->numLocals());
+  auto program = Program::compile(filename, m_stats);
 
-  auto functions = CodeGenerator::getFunctions();
+#ifdef DEBUG
   std::cout << "\n---- PROGRAM DEBUG ----\n\n";
-  for (const auto& fn : functions) {
-    fn->printFunction();
-  }
+  program->printFunctions();
+#endif
 
   std::cout << "\n---- OUTPUT ----\n\n";
+  PhaseTimer timer;
+  VMEndingStatus res;
+  {
+    TraceSpan span("execute", "compiler");
+    res = run(program);
+  }
+  if (m_stats != nullptr) m_stats->execute += timer.elapsed();
+  return res;
+}
+
+VMEndingStatus VM::run(std::shared_ptr<const Program> program) {
+  return run(std::make_shared<Isolate>(std::move(program)));
+}
+
+VMEndingStatus VM::run(std::shared_ptr<Isolate> isolate) {
+  m_isolate = std::move(isolate);
+  m_isolate->heap.setNodeCompaction(m_options.compact_nodes);
+  AllocationProfiler::Scope allocations(this);
+  if (m_options.arena) Nursery::beginRegion();
+  Function* top_level = m_isolate->program->topLevel();
+  Closure top_level_closure(top_level);
+  m_call_stack.push(StackFrame(&top_level_closure));
 
   // run the code
-  VMEndingStatus res = execute(top_level_fn->code());
+  VMEndingStatus res = execute(top_level->code());
+  // The script is done once the fibers it spawned are.
+  if (m_isolate->has_fibers) Scheduler::get().joinAll(*m_isolate);
+  if (m_options.trace_deopt) m_deopt_stats.print(stderr);
+  m_gc_stats = m_isolate->heap.stats();
+  if (m_options.print_gc_stats) m_gc_stats.print(stderr);
+#ifdef LINARO_PROFILE
+  m_profiler.flush();
+  m_opcode_stats.flush();
+#endif
+  AllocationProfiler::endIsolate(m_isolate.get());
+
+  if (m_options.arena) {
+    // Leaks every reference into the region, so that nothing frees the
+    // objects in it. The workers that ran fibers may have blocks of it in
+    // their free lists, and other actors the messages sent to them, the
+    // chunks can't be freed then.
+    bool shared = m_isolate->has_fibers || m_isolate->actors != nullptr;
+    new Stack<Value>(std::move(m_operand_stack));
+    new Stack<StackFrame>(std::move(m_call_stack));
+    new std::vector<std::shared_ptr<CapturedVariable>>(
+        std::move(m_open_captured_variables));
+    new std::shared_ptr<Isolate>(std::move(m_isolate));
+    Nursery::endRegion(!shared);
+    return res;
+  }
 
   // turn off vm (todo)
   m_operand_stack.reset();
   m_call_stack.reset();
+  m_open_captured_variables.clear();
+  m_isolate = nullptr;
 
   // return status code
   return res;
 }
 
+VMEndingStatus VM::runFiber(Closure& closure, const std::vector<Value>& args,
+                           Value& result) {
+  Function* fn = closure.fun();
+  AllocationProfiler::Scope allocations(this);
+  m_call_stack.push(StackFrame(&closure, profile(fn).optimized_code));
+  // Missing arguments are undefined, extra ones are dropped.
+  for (int i = 0; i < fn->numArgs() && i < (int)args.size(); i++) {
+    *getLocal(i) = args[i];
+  }
+  const char* trace_name = nullptr;
+  if (Tracer::enabled()) {
+    trace_name = Tracer::functionName(fn);
+    Tracer::begin(trace_name, "call");
+  }
+  const auto& optimized = m_call_stack.peek().optimized;
+  VMEndingStatus res = execute(optimized ? &optimized->code : fn->code());
+  if (trace_name != nullptr) Tracer::end(trace_name, "call");
+  if (res == VMEndingStatus::VM_SUCCESS) result = m_operand_stack.pop();
+  return res;
+}
+
 void VM::initVM() {}
 
 void VM::runtimeError(const char* format, ...) {
   va_list args;
   va_start(args, format);
-  const Location& loc = m_current_chunk->getLocation(m_ip);
+  // m_ip is past the opcode of the instruction that failed.
+  Location loc = m_current_chunk->getLocation(m_ip - 1);
   Error::reportErrorAt(loc, Error::RuntimeError, format, args);
   va_end(args);
 
@@ -49,7 +122,11 @@ void VM::runtimeError(const char* format, ...) {
 }
 
 uint8_t VM::readByte() { return m_current_chunk->readByte(m_ip++); }
-uint16_t VM::read16BitOperand() { return readByte() | (readByte() << 8); }
+uint16_t VM::read16BitOperand() {
+  // The order the operands of '|' are evaluated in is unspecified.
+  uint16_t low = readByte();
+  return low | (readByte() << 8);
+}
 uint32_t VM::read32BitOperand() {
   return read16BitOperand() | (read16BitOperand() << 16);
 }
@@ -59,7 +136,9 @@ Function* VM::getEnclosingFunction() {
 }
 
 std::vector<Value>& VM::getConstants() {
-  return getEnclosingFunction()->constants();
+  StackFrame& frame = m_call_stack.peek();
+  return frame.optimized ? frame.optimized->constants
+                         : frame.closure->fun()->constants();
 }
 
 Value& VM::getConstant() { return getConstants()[read16BitOperand()]; }
@@ -68,36 +147,69 @@ Value* VM::getCapturedVariable(int i) {
   return m_call_stack.peek().closure->getCapturedVariables()[i]->val;
 }
 
-CapturedVariable* VM::captureVariable(int index) {
+bool VM::capturesOpenVariables(Closure& closure) {
+  for (const auto& cv : closure.getCapturedVariables()) {
+    if (cv->isOpen()) return true;
+  }
+  return false;
+}
+
+std::shared_ptr<CapturedVariable> VM::captureVariable(int index) {
   // Get a pointer to the value we are trying to capture from the local space of
   // the function on the top of the callstack.
-  Value* val = &getConstants()[index];
-
-  int num_captured = getEnclosingFunction()->numCapturedVariables();
-  int num_open_vars = m_open_captured_variables.size();
-  // Go through the list of open captured variables and see if this
-  // variable has already been captured by some other closure, if so then reuse
-  // it. No need to loop more than 'num_captured', since we are only trying to
-  // capture variables of the closest enclosing function.
-  // Correction here: only have to loop for 'index' times right? (actually maybe
-  // not)
-  for (int i = 0; (i <= num_captured) && (i < num_open_vars); i++) {
-    // If the value we are trying to capture points to the same value as this
-    // already open captured variable, then reuse this one. This means that this
-    // closure and the closure that already captured it will now point to the
-    // same variable even if the local variable space goes off the stack and
-    // closes the open variables.
-    if (m_open_captured_variables[i].val == val)
-      return &m_open_captured_variables[i];
+  Value* val = getLocal(index);
+
+  // If some other closure has already captured this variable, reuse it. Both
+  // closures will then point to the same variable even after the local
+  // variable space goes off the stack and the variable is closed.
+  for (const auto& cv : m_open_captured_variables) {
+    if (cv->val == val) return cv;
   }
 
   // The variable has not yet been captured, create a new one.
-  CapturedVariable cv;
-  // Have it point to the captured variable;
-  cv.val = val;
-  // Add it to the list of open captured variables
-  m_open_captured_variables.push_back(cv);
-  return &m_open_captured_variables.back();
+  m_open_captured_variables.push_back(
+      makeObject<CapturedVariable>(CapturedVariable{val, Value()}));
+  m_isolate->heap.track(m_open_captured_variables.back());
+  return m_open_captured_variables.back();
+}
+
+void VM::numberOperation(Bytecode op) {
+  double op2 = m_operand_stack.peek().rawNumber();
+  m_operand_stack.pop_back();
+  Value& result = m_operand_stack.peek();
+  double& op1 = result.rawNumber();
+  switch (op) {
+    case Bytecode::add_num:
+      op1 += op2;
+      break;
+    case Bytecode::sub_num:
+      op1 -= op2;
+      break;
+    case Bytecode::mul_num:
+      op1 *= op2;
+      break;
+    case Bytecode::div_num:
+      op1 /= op2;
+      break;
+    case Bytecode::mod_num:
+      op1 = fmod(op1, op2);
+      break;
+    // Compared the same way as Value::compare() does.
+    case Bytecode::lt_num:
+      result = op1 - op2 < 0;
+      break;
+    case Bytecode::lte_num:
+      result = !(op1 - op2 > 0);
+      break;
+    case Bytecode::gt_num:
+      result = op1 - op2 > 0;
+      break;
+    case Bytecode::gte_num:
+      result = !(op1 - op2 < 0);
+      break;
+    default:
+      UNREACHABLE();
+  }
 }
 
 void VM::binaryOperation(Bytecode op) {
@@ -167,26 +279,365 @@ void VM::binaryOperation(Bytecode op) {
   m_operand_stack.push(result);
 }
 
-VMEndingStatus VM::call(Closure& closure) {
+VMEndingStatus VM::call(Closure& closure, int num_args) {
+  Function* fn = closure.fun();
+  FunctionProfile& fn_profile = profile(fn);
+  // One of the call sites of the function got hot since it was last entered,
+  // try to inline it.
+  if (fn_profile.has_hot_call_sites && canTierUp()) {
+    fn_profile.has_hot_call_sites = false;
+    if (fn_profile.optimized_code == nullptr)
+      fn_profile.optimized_code = Inliner::optimize(*m_isolate, fn);
+  }
+
+  // Remember where to continue in the caller.
+  BytecodeChunk* caller_code = m_current_chunk;
+  m_call_stack.peek().ip = m_ip;
+
+  m_call_stack.push(StackFrame(&closure, fn_profile.optimized_code));
+  // Missing arguments are undefined, extra ones are dropped.
+  for (int i = 0; i < num_args; i++) {
+    if (i < fn->numArgs())
+      *getLocal(i) = m_operand_stack.pop();
+    else
+      m_operand_stack.pop();
+  }
+  // Calls made by the top level of the script, see PerfCounters.
+  bool count_call = PerfCounters::countCalls() && m_call_stack.size() == 2 &&
+                    m_call_stack[0].closure->fun() ==
+                        m_isolate->program->topLevel();
+  PerfCounters::Sample start;
+  if (count_call) start = PerfCounters::read();
+  const char* trace_name = nullptr;
+  if (Tracer::enabled()) {
+    trace_name = Tracer::functionName(fn);
+    Tracer::begin(trace_name, "call");
+  }
+  const auto& optimized = m_call_stack.peek().optimized;
+  VMEndingStatus res = execute(optimized ? &optimized->code : fn->code());
+  if (trace_name != nullptr) Tracer::end(trace_name, "call");
+  if (res != VMEndingStatus::VM_SUCCESS) return res;
+  if (count_call) PerfCounters::addCall(fn, start);
+
+  m_current_chunk = caller_code;
+  m_ip = m_call_stack.peek().ip;
+  return res;
+}
+
+void VM::recordCall(uint32_t offset, const Value& callee) {
+  StackFrame& frame = m_call_stack.peek();
+  if (frame.optimized != nullptr || !callee.isClosure() || !canTierUp())
+    return;
+  Function* caller = frame.closure->fun();
+  Function* fn = callee.valueTo<Closure>().fun();
+  FunctionProfile& caller_profile = profile(caller);
+  if (caller_profile.recordCall(offset, fn) &&
+      Inliner::canInline(*m_isolate, caller, fn))
+    caller_profile.has_hot_call_sites = true;
+}
+
+void VM::onStackReplace(uint32_t loop_header) {
+  StackFrame& frame = m_call_stack.peek();
+  Function* fn = frame.closure->fun();
+  FunctionProfile& fn_profile = profile(fn);
+  if (fn_profile.optimized_code == nullptr) {
+    fn_profile.has_hot_call_sites = false;
+    fn_profile.optimized_code = Inliner::optimize(*m_isolate, fn);
+  }
+  const auto& optimized = fn_profile.optimized_code;
+  if (optimized == nullptr) return;
+  auto entry = optimized->osr_entries.find(loop_header);
+  if (entry == optimized->osr_entries.end()) return;
+  // Growing the local space may move locals that closures point to.
+  if (!m_open_captured_variables.empty()) return;
+
+  // The optimized code keeps the locals of the function in the same slots
+  // and lays out the operand stack the same way, so only the room for the
+  // inlined callees has to be added. Globals are shared by all frames.
+  frame.optimized = optimized;
+  frame.locals.resize(optimized->num_locals);
+  m_current_chunk = &optimized->code;
+  m_ip = entry->second;
+}
+
+bool VM::enterInlined(const InlinedCall& site) {
+  Value& callee = m_operand_stack.peek();
+  if (!callee.isClosure() || callee.valueTo<Closure>().fun() != site.callee)
+    return false;
+
+  // Bind the arguments to the callee's slots in the caller's local space.
+  // The closure is kept around in case the inlined frame has to be
+  // materialized.
+  StackFrame& frame = m_call_stack.peek();
+  Function* fn = site.callee;
+  frame.locals[site.closure_slot] = m_operand_stack.pop();
+  for (int i = 0; i < fn->numArgs(); i++) {
+    frame.locals[site.local_base + i] = m_operand_stack.pop();
+  }
+  for (int i = fn->numArgs(); i < fn->numLocals(); i++) {
+    frame.locals[site.local_base + i] = Value();
+  }
+  return true;
+}
+
+VMEndingStatus VM::deoptimize(uint32_t guard_offset, DeoptReason reason) {
+  StackFrame& frame = m_call_stack.peek();
+  Function* fn = frame.closure->fun();
+  // Keeps the optimized code (and the frame state) alive until the frames
+  // have been rebuilt.
+  std::shared_ptr<OptimizedCode> optimized = std::move(frame.optimized);
+  const FrameState& state = optimized->frame_states.at(guard_offset);
+
+  const Function* guard_fn = state.inlined_frames.empty()
+                                 ? fn
+                                 : state.inlined_frames.back().fn;
+  m_deopt_stats.record(guard_fn, state.baseline_offset, reason);
+  if (m_options.trace_deopt) {
+    fprintf(stderr, "[deopt] %s: %s @%u in %s\n",
+            std::string(fn->name()).c_str(),
+            DeoptStats::reasonToString(reason), state.baseline_offset,
+            std::string(guard_fn->name()).c_str());
+  }
+
+  // New calls of the function go to the baseline code, and the call site
+  // behind the guard will not be inlined again.
+  if (canTierUp()) {
+    profile(fn).optimized_code = nullptr;
+    CallSiteFeedback* feedback =
+        profile(guard_fn).getCallSiteFeedback(state.baseline_offset);
+    if (feedback != nullptr) feedback->is_polymorphic = true;
+  }
+
+  // Shrinking keeps the locals where captured variables point to them.
+  std::vector<Value> locals = frame.locals;
+  frame.locals.resize(fn->numLocals());
+  m_current_chunk = fn->code();
+  if (state.inlined_frames.empty()) {
+    m_ip = state.baseline_offset;
+    return VMEndingStatus::VM_SUCCESS;
+  }
+
+  // The outermost frame continues after the call that was inlined, once
+  // the inlined frames have returned.
+  m_ip = state.inlined_frames.front().return_offset;
+  return materializeFrames(state, 0, locals);
+}
+
+VMEndingStatus VM::materializeFrames(const FrameState& state, size_t i,
+                                     const std::vector<Value>& locals) {
+  const InlinedFrameState& inlined = state.inlined_frames[i];
+  BytecodeChunk* caller_code = m_current_chunk;
+  m_call_stack.peek().ip = m_ip;
+
+  Closure& closure = locals[inlined.closure_slot].valueTo<Closure>();
   m_call_stack.push(StackFrame(&closure));
-  for (int i = 0; i < closure.fun()->numArgs(); i++) {
-    *getLocal(i) = m_operand_stack.pop();
+  StackFrame& frame = m_call_stack.peek();
+  for (int j = 0; j < inlined.fn->numLocals(); j++) {
+    frame.locals[j] = locals[inlined.local_base + j];
+  }
+
+  m_current_chunk = inlined.fn->code();
+  if (i + 1 < state.inlined_frames.size()) {
+    m_ip = state.inlined_frames[i + 1].return_offset;
+    VMEndingStatus res = materializeFrames(state, i + 1, locals);
+    if (res != VMEndingStatus::VM_SUCCESS) return res;
+  } else {
+    m_ip = state.baseline_offset;
   }
-  return execute(closure.fun()->code());
+
+  VMEndingStatus res = execute(inlined.fn->code(), m_ip);
+  if (res != VMEndingStatus::VM_SUCCESS) return res;
+  m_current_chunk = caller_code;
+  m_ip = m_call_stack.peek().ip;
+  return res;
+}
+
+VMEndingStatus VM::callNative(const NativeFunction& fn, int num_args) {
+  NativeCall call;
+  for (int i = 0; i < num_args; i++) call.args.push_back(m_operand_stack.pop());
+  call.isolate = m_isolate;
+  fn.call(call);
+  if (call.error != nullptr) {
+    runtimeError("%s", call.error);
+    return VMEndingStatus::VM_RUNTIME_ERR;
+  }
+  m_operand_stack.push(call.result);
+  return VMEndingStatus::VM_SUCCESS;
+}
+
+VMEndingStatus VM::spawnOrJoin(Bytecode op, int num_args) {
+  Value callee = m_operand_stack.pop();
+  std::vector<Value> args;
+  for (int i = 0; i < num_args; i++) args.push_back(m_operand_stack.pop());
+
+  if (op == Bytecode::join && callee.isThread()) {
+    if (num_args > 0) {
+      runtimeError("Attempted passing arguments when joining a fiber.");
+      return VMEndingStatus::VM_RUNTIME_ERR;
+    }
+    Thread& fiber = callee.valueTo<Thread>();
+    Scheduler::get().join(fiber);
+    m_operand_stack.push(fiber.result());
+    return VMEndingStatus::VM_SUCCESS;
+  }
+  if (!callee.isClosure()) {
+    runtimeError("Attempted invoking non-callable object.");
+    return VMEndingStatus::VM_RUNTIME_ERR;
+  }
+
+  if (op == Bytecode::spawn &&
+      capturesOpenVariables(callee.valueTo<Closure>())) {
+    runtimeError(
+        "Attempted spawning a closure that captures variables of a running "
+        "function.");
+    return VMEndingStatus::VM_RUNTIME_ERR;
+  }
+
+  auto fiber = std::make_shared<Thread>(callee, std::move(args), m_isolate);
+  Scheduler::get().spawn(fiber);
+  if (op == Bytecode::join) {
+    // A synchronous call in a fiber of its own.
+    Scheduler::get().join(*fiber);
+    m_operand_stack.push(fiber->result());
+  } else {
+    m_operand_stack.push(Value(std::shared_ptr<Object>(fiber)));
+  }
+  return VMEndingStatus::VM_SUCCESS;
+}
+
+VMEndingStatus VM::parallelFor(int num_reductions, uint16_t ops) {
+  Value end = m_operand_stack.pop();
+  Value start = m_operand_stack.pop();
+  Value body = m_operand_stack.pop();
+  std::vector<Value> results(num_reductions);
+  for (int i = num_reductions - 1; i >= 0; i--) {
+    results[i] = m_operand_stack.pop();
+  }
+  if (!start.isNumber() || !end.isNumber()) {
+    runtimeError("Attempted looping over a range that isn't numbers.");
+    return VMEndingStatus::VM_RUNTIME_ERR;
+  }
+
+  double lo = start.asNumber();
+  double hi = end.asNumber();
+  size_t size = hi > lo ? (size_t)std::ceil(hi - lo) : 0;
+  int num_chunks = Scheduler::numChunks(size);
+  std::vector<Value> partials(num_chunks);
+  Closure& closure = body.valueTo<Closure>();
+  auto run_chunk = [&](VM& vm, int chunk, size_t begin, size_t end) {
+    std::vector<Value> args{Value(lo + begin), Value(std::min(lo + end, hi))};
+    return vm.runFiber(closure, args, partials[chunk]) ==
+           VMEndingStatus::VM_SUCCESS;
+  };
+  if (size > 0 && !Scheduler::runChunks(m_isolate, size, num_chunks, run_chunk))
+    return VMEndingStatus::VM_RUNTIME_ERR;
+
+  // The chunks are combined in order, so only the operator of a reduction
+  // has to be associative.
+  for (int i = 0; i < num_reductions && size > 0; i++) {
+    auto op = static_cast<ReductionOp>((ops >> (2 * i)) & 3);
+    Value& result = results[i];
+    for (const Value& partial : partials) {
+      Value val = partial.valueTo<Array>().get((double)i);
+      switch (op) {
+        case ReductionOp::add:
+          result = result + val;
+          break;
+        case ReductionOp::mul:
+          result = result * val;
+          break;
+        case ReductionOp::min:
+          if (Value::compare(val, result) == Value::lt) result = val;
+          break;
+        case ReductionOp::max:
+          if (Value::compare(val, result) == Value::gt) result = val;
+          break;
+      }
+    }
+  }
+  for (const Value& result : results) m_operand_stack.push(result);
+  return VMEndingStatus::VM_SUCCESS;
 }
 
 void VM::returnFromFunction() {
   // Close the captured variables
+  std::vector<Value>& locals = m_call_stack.peek().locals;
+  auto& open = m_open_captured_variables;
+  for (size_t i = 0; i < open.size();) {
+    CapturedVariable* cv = open[i].get();
+    if (cv->val >= locals.data() && cv->val < locals.data() + locals.size()) {
+      cv->closed = *cv->val;
+      cv->val = &cv->closed;
+      open[i] = open.back();
+      open.pop_back();
+    } else {
+      i++;
+    }
+  }
 
   // Remove stack frame from call stack
   m_call_stack.pop_back();
 }
 
-VMEndingStatus VM::execute(BytecodeChunk* _code) {
-  m_ip = 0;
-  m_current_chunk = _code;
-  const std::vector<uint8_t>& code = _code->code();
+void VM::sample() {
+  std::string stack;
+  size_t depth = m_call_stack.size();
+  for (size_t i = 0; i < depth; i++) {
+    StackFrame& frame = m_call_stack[i];
+    Function* fn = frame.closure->fun();
+    const BytecodeChunk* code = m_current_chunk;
+    uint32_t offset = m_ip - 1;
+    // The frames below the top one are in the call just before 'ip'.
+    if (i + 1 < depth) {
+      code = frame.optimized ? &frame.optimized->code : fn->code();
+      offset = frame.ip - 1;
+    }
+    if (i > 0) stack += ';';
+    stack += fn->name();
+    stack += ':';
+    stack += std::to_string(code->getLocation(offset).line);
+  }
+  Sampler::record(stack);
+}
+
+inline void VM::loadGlobal(uint16_t index) {
+  Value& global = m_isolate->globals[index];
+  if (!m_isolate->has_fibers.load(std::memory_order_relaxed)) {
+    m_operand_stack.push(global);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(m_isolate->globalLock(index));
+  m_operand_stack.push(global);
+}
+
+inline void VM::storeGlobal(uint16_t index) {
+  Value& global = m_isolate->globals[index];
+  if (!m_isolate->has_fibers.load(std::memory_order_relaxed)) {
+    global = m_operand_stack.peek();
+    return;
+  }
+  // The old value is released once the lock is, freeing it may take long.
+  Value old = m_operand_stack.peek();
+  std::lock_guard<std::mutex> lock(m_isolate->globalLock(index));
+  std::swap(global, old);
+}
+
+VMEndingStatus VM::execute(BytecodeChunk* code, uint32_t ip) {
+  m_ip = ip;
+  m_current_chunk = code;
   for (;;) {
+#ifdef LINARO_PROFILE
+    if (Profiler::enabled()) {
+      m_profiler.instruction(m_call_stack.peek().closure->fun(),
+                             m_current_chunk, m_ip,
+                             static_cast<Bytecode>((*m_current_chunk)[m_ip]));
+    }
+    if (OpcodeStats::enabled()) {
+      m_opcode_stats.instruction(
+          m_current_chunk, m_ip,
+          static_cast<Bytecode>((*m_current_chunk)[m_ip]));
+    }
+#endif
     Bytecode op = static_cast<Bytecode>(readByte());
     switch (op) {
       case Bytecode::nop:
@@ -225,12 +676,80 @@ VMEndingStatus VM::execute(BytecodeChunk* _code) {
       case Bytecode::neg:
         m_operand_stack.peek() = -m_operand_stack.peek().asNumber();
         break;
+      case Bytecode::incr_num:
+        m_operand_stack.peek().rawNumber() += 1;
+        break;
+      case Bytecode::decr_num:
+        m_operand_stack.peek().rawNumber() -= 1;
+        break;
+      case Bytecode::add_num:
+      case Bytecode::sub_num:
+      case Bytecode::mod_num:
+      case Bytecode::mul_num:
+      case Bytecode::div_num:
+      case Bytecode::lt_num:
+      case Bytecode::lte_num:
+      case Bytecode::gt_num:
+      case Bytecode::gte_num:
+        numberOperation(op);
+        break;
+      case Bytecode::neg_num: {
+        double& num = m_operand_stack.peek().rawNumber();
+        num = -num;
+        break;
+      }
       case Bytecode::NOT:
         m_operand_stack.peek() = !m_operand_stack.peek().asBoolean();
         break;
       case Bytecode::to_bool:
         m_operand_stack.peek() = m_operand_stack.peek().asBoolean();
         break;
+      case Bytecode::jmp_loop: {
+        if (Sampler::takeSample()) sample();
+        uint16_t header = read16BitOperand();
+        uint16_t loop = read16BitOperand();
+        m_ip = header;
+        StackFrame& frame = m_call_stack.peek();
+        if (frame.optimized == nullptr && canTierUp() &&
+            profile(frame.closure->fun()).recordBackEdge(loop))
+          onStackReplace(header);
+        break;
+      }
+      case Bytecode::for_prep: {
+        uint16_t exit = read16BitOperand();
+        Value* counter = getLocal(read16BitOperand());
+        Value end = m_operand_stack.pop();
+        Value start = m_operand_stack.pop();
+        if (!start.isNumber() || !end.isNumber()) {
+          runtimeError("Attempted looping over a range that isn't numbers.");
+          return VMEndingStatus::VM_RUNTIME_ERR;
+        }
+        counter[0] = start;
+        counter[1] = end;
+        if (!(start.asNumber() < end.asNumber())) m_ip = exit;
+        break;
+      }
+      case Bytecode::for_step: {
+        if (Sampler::takeSample()) sample();
+        uint16_t header = read16BitOperand();
+        Value* counter = getLocal(read16BitOperand());
+        uint16_t loop = read16BitOperand();
+        double& i = counter[0].rawNumber();
+        if (++i < counter[1].rawNumber()) {
+          m_ip = header;
+          StackFrame& frame = m_call_stack.peek();
+          if (frame.optimized == nullptr && canTierUp() &&
+              profile(frame.closure->fun()).recordBackEdge(loop))
+            onStackReplace(header);
+        }
+        break;
+      }
+      case Bytecode::parallel_for: {
+        uint16_t num_reductions = read16BitOperand();
+        VMEndingStatus res = parallelFor(num_reductions, read16BitOperand());
+        if (res != VMEndingStatus::VM_SUCCESS) return res;
+        break;
+      }
       case Bytecode::jmp:
         m_ip = read16BitOperand();
         break;
@@ -239,13 +758,12 @@ VMEndingStatus VM::execute(BytecodeChunk* _code) {
           // TOS was true, make the jump.
           m_ip = read16BitOperand();
 
-          // Resolve jump-to-jump labels. (maybe also check for 'jmp' here?)
-          while (code[m_ip++] == Bytecode::jmp_true) {
-            m_ip = read16BitOperand();
+          // Resolve jump-to-jump labels. TOS is still true, so a jmp_true at
+          // the target jumps too and a jmp_false falls through.
+          while (m_current_chunk->readByte(m_ip) == Bytecode::jmp_true) {
+            m_ip = m_current_chunk->read16Bits(m_ip + 1);
           }
-
-          // figure out what this was for
-          if (code[m_ip] == Bytecode::jmp_false) {
+          if (m_current_chunk->readByte(m_ip) == Bytecode::jmp_false) {
             m_ip += 3;
             m_operand_stack.pop_back();
           }
@@ -260,13 +778,12 @@ VMEndingStatus VM::execute(BytecodeChunk* _code) {
           // TOS was false, make the jump.
           m_ip = read16BitOperand();
 
-          // Resolve jump-to-jump labels. (maybe also check for 'jmp' here?)
-          while (code[m_ip++] == Bytecode::jmp_false) {
-            m_ip = read16BitOperand();
+          // Resolve jump-to-jump labels. TOS is still false, so a jmp_false
+          // at the target jumps too and a jmp_true falls through.
+          while (m_current_chunk->readByte(m_ip) == Bytecode::jmp_false) {
+            m_ip = m_current_chunk->read16Bits(m_ip + 1);
           }
-
-          // skip past jmp_true AND its operand, which is 5 bytes.
-          if (code[m_ip] == Bytecode::jmp_true) {
+          if (m_current_chunk->readByte(m_ip) == Bytecode::jmp_true) {
             m_ip += 3;
             m_operand_stack.pop_back();
           }
@@ -283,12 +800,15 @@ VMEndingStatus VM::execute(BytecodeChunk* _code) {
         break;
       case Bytecode::new_array: {
         int size = read16BitOperand();
-        auto arr = std::make_shared<Array>();
+        auto arr = makeObject<Array>();
         // 'i' will be int when values can contain integers.
         for (double i = 0; i < size; i++) {
           arr->insert(Value(i), m_operand_stack.pop());
         }
+        AllocationProfiler::allocated(arr);
+        m_isolate->heap.track(arr);
         m_operand_stack.push(Value(arr));
+        safepoint();
         break;
       }
       case Bytecode::TRUE:
@@ -301,14 +821,15 @@ VMEndingStatus VM::execute(BytecodeChunk* _code) {
         m_operand_stack.push(Value(ValueType::nNoll));
         break;
       case Bytecode::gload:
-        m_operand_stack.push(m_globals[read16BitOperand()]);
+        loadGlobal(read16BitOperand());
         break;
       case Bytecode::gstore:
-        m_globals[read16BitOperand()] = m_operand_stack.peek();
+        writeBarrier(m_operand_stack.peek());
+        storeGlobal(read16BitOperand());
         // m_operand_stack.pop_back();
         break;
       case Bytecode::load:
-        m_operand_stack.push(getLocal(read16BitOperand()));
+        m_operand_stack.push(*getLocal(read16BitOperand()));
         break;
       case Bytecode::store:
         *getLocal(read16BitOperand()) = m_operand_stack.pop();
@@ -317,19 +838,27 @@ VMEndingStatus VM::execute(BytecodeChunk* _code) {
         m_operand_stack.push(*getCapturedVariable(read16BitOperand()));
         break;
       case Bytecode::cstore:
+        writeBarrier(m_operand_stack.peek());
         *getCapturedVariable(read16BitOperand()) = m_operand_stack.pop();
         break;
       case Bytecode::aload:
       case Bytecode::astore: {
         Value key = m_operand_stack.pop();
         Value _arr = m_operand_stack.pop();
-        if (!_arr.isArray())
+        if (!_arr.isArray()) {
           runtimeError("Attempted array access [expr] was not an array.");
+          return VMEndingStatus::VM_RUNTIME_ERR;
+        }
         Array& arr = _arr.valueTo<Array>();
-        if (op == Bytecode::aload)
+        if (op == Bytecode::aload) {
           m_operand_stack.push(arr.get(key));
-        else
+        } else if (arr.isFrozen()) {
+          runtimeError("Attempted changing a frozen array.");
+          return VMEndingStatus::VM_RUNTIME_ERR;
+        } else {
+          writeBarrier(m_operand_stack.peek());
           arr.insert(key, m_operand_stack.pop());
+        }
         break;
       }
       case Bytecode::print:
@@ -337,15 +866,44 @@ VMEndingStatus VM::execute(BytecodeChunk* _code) {
         break;
       case Bytecode::ret:
         returnFromFunction();
-        break;
+        return VMEndingStatus::VM_SUCCESS;
       case Bytecode::call:
         UNREACHABLE();
         break;
       case Bytecode::call_tos: {
+        if (Sampler::takeSample()) sample();
+        uint32_t call_site = m_ip - 1;
+        int num_args = read16BitOperand();
         Value closure = m_operand_stack.pop();
-        if (!closure.isClosure())
+        if (closure.isNativeFunction()) {
+          VMEndingStatus res =
+              callNative(closure.valueTo<NativeFunction>(), num_args);
+          if (res != VMEndingStatus::VM_SUCCESS) return res;
+          break;
+        }
+        if (!closure.isClosure()) {
           runtimeError("Attempted invoking non-callable object.");
-        call(closure.valueTo<Closure>());
+          return VMEndingStatus::VM_RUNTIME_ERR;
+        }
+        recordCall(call_site, closure);
+        VMEndingStatus res = call(closure.valueTo<Closure>(), num_args);
+        if (res != VMEndingStatus::VM_SUCCESS) return res;
+        break;
+      }
+      case Bytecode::spawn:
+      case Bytecode::join: {
+        VMEndingStatus res = spawnOrJoin(op, read16BitOperand());
+        if (res != VMEndingStatus::VM_SUCCESS) return res;
+        break;
+      }
+      case Bytecode::invoke_inline: {
+        uint32_t guard = m_ip - 1;
+        const auto& optimized = m_call_stack.peek().optimized;
+        CHECK(optimized != nullptr);
+        if (!enterInlined(optimized->inlined_calls[read16BitOperand()])) {
+          VMEndingStatus res = deoptimize(guard, DeoptReason::wrong_callee);
+          if (res != VMEndingStatus::VM_SUCCESS) return res;
+        }
         break;
       }
       case Bytecode::closure: {
@@ -354,7 +912,8 @@ VMEndingStatus VM::execute(BytecodeChunk* _code) {
         CHECK(v.isFunction());
         Function& fn = v.valueTo<Function>();
         // Construct a closure from this function
-        auto closure = std::make_shared<Closure>(Closure(&fn));
+        auto closure = makeObject<Closure>(Closure(&fn));
+        m_isolate->heap.track(closure);
         // Initialize the captured variables of this closure
         for (int i = 0; i < fn.numCapturedVariables(); i++) {
           // Extract the compile-time captured variable from the function
@@ -380,9 +939,16 @@ VMEndingStatus VM::execute(BytecodeChunk* _code) {
             closure->addCapturedVariable(cv_tos[compiler_captured->index]);
           }
         }
+        if (canCollect()) {
+          for (const auto& cv : closure->getCapturedVariables()) {
+            m_isolate->heap.writeBarrier(cv.get());
+          }
+        }
+        AllocationProfiler::allocated(closure);
         // The captured variables are now pointing to the right place, push
         // the closure to the operand stack.
         m_operand_stack.push(Value(closure));
+        safepoint();
       } break;
       case Bytecode::halt:
         return VMEndingStatus::VM_SUCCESS;
@@ -7,7 +7,16 @@
 
 #include "../linaro_utils/common.h"
 #include "../linaro_utils/utils.h"
+#include "../code_generator/inliner.h"
+#include "allocation_profiler.h"
+#include "deoptimizer.h"
 #include "objects.h"
+#include "opcode_stats.h"
+#include "profiler.h"
+#include "program.h"
+#include "sampler.h"
+#include "scheduler.h"
+#include "tracer.h"
 #include "vm_context.h"
 
 class BytecodeChunk;
@@ -15,13 +24,16 @@ class BytecodeChunk;
 namespace Linaro {
 
 struct StackFrame {
-  StackFrame(Closure *closure) : closure{closure} {
-    locals.resize(closure->fun()->numLocals());
-  }
+  StackFrame(Closure *closure,
+             std::shared_ptr<OptimizedCode> optimized = nullptr);
 
+  // Where to continue in this function once the function it has called
+  // returns.
   uint32_t ip;
   Closure *closure;
   std::vector<Value> locals;
+  // Set if the frame is running the inlined version of the function.
+  std::shared_ptr<OptimizedCode> optimized;
 };
 
 // Inspired by this: https://github.com/lua/lua/blob/master/lobject.h#L578
@@ -43,6 +55,11 @@ struct CapturedVariable {
   // std::variant<Value, CapturedVariable *> status;
   Value closed;
   // The closed variable
+
+  bool isOpen() const { return val != &closed; }
+
+  // Node of the variable in the heap of its isolate, see Heap.
+  uint32_t heap_index = UINT32_MAX;
 };
 
 enum VMEndingStatus : uint8_t { VM_SUCCESS, VM_COMPILE_ERR, VM_RUNTIME_ERR };
@@ -50,24 +67,126 @@ enum VMEndingStatus : uint8_t { VM_SUCCESS, VM_COMPILE_ERR, VM_RUNTIME_ERR };
 class VM {
  public:
   VM() {}
+  // A VM running a fiber in 'isolate'.
+  explicit VM(std::shared_ptr<Isolate> isolate)
+      : m_isolate{std::move(isolate)} {}
+#ifdef LINARO_PROFILE
+  ~VM() {
+    m_profiler.flush();
+    m_opcode_stats.flush();
+  }
+#endif
   int operandStackSize() { return m_operand_stack.size(); }
   // Create a vm instance from source file and execute
   VMEndingStatus interpret(const char *filename);
 
+  // Runs 'program' in a new isolate. Any number of VMs can run the same
+  // program at once on different threads.
+  VMEndingStatus run(std::shared_ptr<const Program> program);
+  // Runs the program of 'isolate' in it.
+  VMEndingStatus run(std::shared_ptr<Isolate> isolate);
+
+  // Calls 'closure' with 'args' as the bottom frame of this VM, and stores
+  // its return value in 'result'.
+  VMEndingStatus runFiber(Closure &closure, const std::vector<Value> &args,
+                          Value &result);
+
+  // Whether 'closure' captures variables of a function still running. A
+  // fiber can't run it alongside that function, which accesses them without
+  // any locking and closes them when it returns.
+  static bool capturesOpenVariables(Closure &closure);
+
   // Execute from predefined vm environment (?)
   VMEndingStatus interpret(const VMContext &vm_context);
 
+  void setOptions(const VMOptions &options) { m_options = options; }
+  const DeoptStats &deoptStats() const { return m_deopt_stats; }
+  // What the collector did in the isolate of the last run().
+  const GcStats &gcStats() const { return m_gc_stats; }
+  // Add the time and counts of compiling and running to 'stats' in
+  // interpret(const char *).
+  void setStats(RunStats *stats) { m_stats = stats; }
+
+  // The function and the location of the instruction running, and the
+  // isolate it runs in. See AllocationProfiler.
+  Function *currentFunction() { return m_call_stack.peek().closure->fun(); }
+  Location currentLocation() const {
+    return m_current_chunk->getLocation(m_ip - 1);
+  }
+  const Isolate *isolate() const { return m_isolate.get(); }
+
  private:
   void initVM();
 
   // Runs main bytecodechunk initially. Upon function calls,
   // this will be called recursively for the function's bytecodechunk.
-  VMEndingStatus execute(BytecodeChunk *code);
+  VMEndingStatus execute(BytecodeChunk *code, uint32_t ip = 0);
 
   // Function call/return
-  VMEndingStatus call(Closure &v);
+  // Calls 'v' with the 'num_args' arguments on top of the operand stack.
+  VMEndingStatus call(Closure &v, int num_args);
   void returnFromFunction();
 
+  // Binds the arguments of a callee inlined at a call site. Returns false,
+  // leaving the operand stack untouched, if the closure on top of the stack
+  // isn't an instance of the inlined function.
+  bool enterInlined(const InlinedCall &site);
+
+  // Moves the frame on top of the call stack, which is running baseline code,
+  // to the optimized code of its function at the loop starting at
+  // 'loop_header'. Does nothing if the loop can't be entered there.
+  void onStackReplace(uint32_t loop_header);
+
+  // Transfers the frame on top of the call stack from optimized code back to
+  // baseline code, using the frame state recorded for the guard at
+  // 'guard_offset'.
+  VMEndingStatus deoptimize(uint32_t guard_offset, DeoptReason reason);
+
+  // Rebuilds the StackFrame of inlined frame 'i' in 'state' (and of the
+  // frames inlined into it) from the optimized 'locals', and runs them until
+  // frame 'i' returns.
+  VMEndingStatus materializeFrames(const FrameState &state, size_t i,
+                                   const std::vector<Value> &locals);
+
+  // Updates the call site feedback of the function running in baseline code.
+  inline void recordCall(uint32_t offset, const Value &callee);
+
+  inline FunctionProfile &profile(const Function *fn) {
+    return m_isolate->profile(fn);
+  }
+
+  // Inlining, OSR and invalidating optimized code update the profiles, which
+  // the fibers of the isolate share. Only done while the isolate runs on a
+  // single OS thread.
+  inline bool canTierUp() const {
+    return !m_isolate->has_fibers.load(std::memory_order_relaxed);
+  }
+
+  // The collector only runs, and only has to see stores, while no fibers of
+  // the isolate run.
+  inline bool canCollect() const {
+    return m_isolate->num_fibers.load(std::memory_order_acquire) == 0;
+  }
+  inline void writeBarrier(const Value &val) {
+    if (canCollect()) m_isolate->heap.writeBarrier(val);
+  }
+  inline void safepoint() {
+    if (canCollect()) m_isolate->heap.safepoint();
+  }
+
+  // Calls a built-in function with the 'num_args' arguments on the operand
+  // stack.
+  VMEndingStatus callNative(const NativeFunction &fn, int num_args);
+
+  // f&(args), f#(args) and t#().
+  VMEndingStatus spawnOrJoin(Bytecode op, int num_args);
+
+  // Runs the body of a parallel for loop over the range on the operand stack
+  // in chunks, and combines the values of the 'num_reductions' reduction
+  // variables below the body. Two bits of 'ops' per variable hold its
+  // ReductionOp.
+  VMEndingStatus parallelFor(int num_reductions, uint16_t ops);
+
   // Extracting data from bytecode chunk
   inline uint8_t readByte();
   inline uint16_t read16BitOperand();
@@ -88,9 +207,20 @@ class VM {
 
   // Evaluating a binary operation
   void binaryOperation(Bytecode op);
+  // Binary operations specialized for two numbers.
+  void numberOperation(Bytecode op);
 
   // Find the captured variable from the open captured variables
-  CapturedVariable *captureVariable(int index);
+  std::shared_ptr<CapturedVariable> captureVariable(int index);
+
+  // Push the global 'index', or store the top of the operand stack in it.
+  // The fibers of the isolate share the globals, see Isolate::globalLock().
+  void loadGlobal(uint16_t index);
+  void storeGlobal(uint16_t index);
+
+  // Records the call stack for the Sampler, with the instruction just read
+  // on top.
+  void sample();
 
   // Runtime error
   void runtimeError(const char *format, ...);
@@ -101,8 +231,8 @@ class VM {
   // Instruction pointer into currently executing chunk
   uint32_t m_ip;
 
-  // Global variable space
-  std::vector<Value> m_globals;
+  // Globals and profiles, shared with the fibers of the script.
+  std::shared_ptr<Isolate> m_isolate;
 
   // Operand stack
   Stack<Value> m_operand_stack;
@@ -110,9 +240,17 @@ class VM {
   // Call stack
   Stack<StackFrame> m_call_stack;
 
-  // This is where all open captured variables will be stored.
-  // It should be a linked list.
-  std::vector<CapturedVariable> m_open_captured_variables;
+  // The captured variables still pointing into the local space of a frame.
+  std::vector<std::shared_ptr<CapturedVariable>> m_open_captured_variables;
+
+  VMOptions m_options;
+  DeoptStats m_deopt_stats;
+  GcStats m_gc_stats;
+  RunStats *m_stats = nullptr;
+#ifdef LINARO_PROFILE
+  Profiler m_profiler;
+  OpcodeStats m_opcode_stats;
+#endif
 };
 
 }  // namespace Linaro
@@ -0,0 +1,50 @@
+#!/bin/sh
+# Runs each script with the interpreter and as C emitted by --emit-c, and
+# diffs what they print.
+#
+# usage: tools/aot_diff.sh <build dir> script.lo...
+#
+# The build dir must contain the linaro binary and liblinaro_core.a.
+# CC and CFLAGS are used to compile the emitted C.
+
+if [ $# -lt 2 ]; then
+  echo "usage: $0 <build dir> script.lo..." >&2
+  exit 2
+fi
+
+build=$(cd "$1" && pwd)
+shift
+root=$(cd "$(dirname "$0")/.." && pwd)
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+failed=0
+for script in "$@"; do
+  name=$(basename "$script" .lo)
+
+  # Everything the interpreter prints after the output banner, minus the
+  # execution time it appends.
+  expected=$("$build/linaro" "$script" 2>/dev/null |
+    sed -n '/^---- OUTPUT ----$/,$p' | tail -n +3 |
+    sed 's/Execution time: [0-9.e+-]*$//')
+
+  if ! "$build/linaro" --emit-c "$script" -o "$tmp/$name.c" ||
+     ! ${CC:-cc} ${CFLAGS:--O2} -I"$root/src/aot" "$tmp/$name.c" \
+         "$build/liblinaro_core.a" -lstdc++ -lm -lpthread -o "$tmp/$name"; then
+    echo "FAIL $script (emit/compile)"
+    failed=1
+    continue
+  fi
+  actual=$("$tmp/$name" 2>/dev/null)
+
+  if [ "$expected" = "$actual" ]; then
+    echo "ok   $script"
+  else
+    echo "FAIL $script"
+    printf '%s\n' "$expected" > "$tmp/expected"
+    printf '%s\n' "$actual" > "$tmp/actual"
+    diff -u "$tmp/expected" "$tmp/actual" | sed 's/^/     /'
+    failed=1
+  fi
+done
+exit $failed
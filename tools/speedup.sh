@@ -0,0 +1,30 @@
+#!/bin/sh
+# Runs a script with 1 to N scheduler workers and prints the wall time and
+# the speedup over one worker for each, e.g. for scripts using pmap().
+#
+# usage: tools/speedup.sh <linaro binary> script.lo [max workers]
+#
+# The maximum defaults to the number of cores.
+
+if [ $# -lt 2 ]; then
+  echo "usage: $0 <linaro binary> script.lo [max workers]" >&2
+  exit 2
+fi
+
+linaro=$1
+script=$2
+max=${3:-$(nproc)}
+
+echo "workers  seconds  speedup"
+base=
+workers=1
+while [ "$workers" -le "$max" ]; do
+  start=$(date +%s.%N)
+  LINARO_WORKERS=$workers "$linaro" "$script" >/dev/null 2>&1
+  end=$(date +%s.%N)
+  seconds=$(awk "BEGIN { print $end - $start }")
+  [ -z "$base" ] && base=$seconds
+  awk "BEGIN { printf \"%7d  %7.3f  %7.2f\\n\", $workers, $seconds, \
+    $base / $seconds }"
+  workers=$((workers * 2))
+done